@@ -0,0 +1,278 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fft.h"
+#include "wav.h"
+
+const char* USAGE =
+    "bench_fft [--min-log K] [--max-log K] [--seconds S] [--threads N] [--wav-frames F] [--output result.json]";
+
+/* Sweeps FftPlan and commpressData over powers of two and runs the whole
+ * WAV to WAV path on synthetic files, then prints one JSON document so two
+ * builds can be compared with a plain diff. Every measurement repeats the
+ * operation for at least the given time and reports the fastest run. */
+struct BenchOptions {
+    size_t min_log = 6;
+    size_t max_log = 24;
+    double seconds = 0.2;
+    size_t threads = 1;
+    /* frames of the synthetic files, 0 turns the file benchmark off */
+    size_t wav_frames = size_t(1) << 22;
+    std::string output;
+};
+
+bool parseArguments(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value(argv[++i]);
+        if (arg == "--min-log") {
+            options.min_log = std::atoi(value.c_str());
+        } else if (arg == "--max-log") {
+            options.max_log = std::atoi(value.c_str());
+        } else if (arg == "--seconds") {
+            options.seconds = std::atof(value.c_str());
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--wav-frames") {
+            options.wav_frames = std::atoll(value.c_str());
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+    }
+    return options.min_log >= 1 && options.min_log <= options.max_log && options.max_log < 40;
+}
+
+/* the process high-water mark, bytes */
+size_t peakRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+/* the fastest of the runs of body() that fit into seconds, at least three */
+template <typename Body>
+double fastestSeconds(double seconds, Body body) {
+    double fastest = 0;
+    double total = 0;
+    for (int run = 0; run < 3 || total < seconds; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        total += elapsed.count();
+        fastest = run == 0 ? elapsed.count() : std::min(fastest, elapsed.count());
+    }
+    return fastest;
+}
+
+/* one object of the "transforms" array */
+template <typename T>
+std::string benchTransforms(size_t log_n, const BenchOptions& options) {
+    size_t n = size_t(1) << log_n;
+    std::mt19937 random(log_n);
+    std::uniform_real_distribution<T> value(-1, 1);
+
+    std::vector<std::complex<T>> data(n);
+    for (auto& x : data) {
+        x = std::complex<T>(value(random), value(random));
+    }
+    FftPlan<T> plan(n);
+    double fft_seconds = fastestSeconds(options.seconds, [&]() {
+        plan.transform(data.data(), false);
+    });
+    std::vector<std::complex<T>>().swap(data);
+
+    std::vector<T> samples(n);
+    for (auto& x : samples) {
+        x = value(random);
+    }
+    RealFftPlan<T> real_plan(n);
+    std::vector<T> work;
+    work.reserve(n + 2);
+    double compress_seconds = fastestSeconds(options.seconds, [&]() {
+        work.assign(samples.begin(), samples.end());
+        commpressData(work, real_plan, 20);
+    });
+
+    /* 5 N log2 N is the flop count of a radix-2 complex FFT by convention */
+    double flops = 5.0 * n * log_n;
+    std::ostringstream out;
+    out << "{\"precision\": \"" << (sizeof(T) == sizeof(float) ? "float" : "double") << "\""
+        << ", \"size\": " << n
+        << ", \"kernel\": \"" << plan.kernelName() << "\""
+        << ", \"fft_ns\": " << fft_seconds * 1e9
+        << ", \"fft_gflops\": " << flops / fft_seconds * 1e-9
+        << ", \"compress_ns\": " << compress_seconds * 1e9
+        << ", \"compress_ns_per_sample\": " << compress_seconds * 1e9 / n
+        << ", \"peak_rss\": " << peakRss() << "}";
+    return out.str();
+}
+
+/* a synthetic 16- or 24-bit file: a few tones and some noise */
+bool writeSyntheticWav(const std::string& path, size_t frames, size_t channels, size_t bits) {
+    WAVHEADER header = {};
+    header.audioFormat = 1;
+    header.numChannels = channels;
+    header.sampleRate = 44100;
+    header.bitsPerSample = bits;
+    header.blockAlign = bits / 8 * channels;
+    header.byteRate = header.sampleRate * header.blockAlign;
+    WavFile file;
+    if (!file.create(path, header, frames * header.blockAlign)) {
+        return false;
+    }
+    char* data = file.data();
+    double scale = std::ldexp(1.0, bits - 16);
+    std::mt19937 random(frames);
+    std::normal_distribution<double> noise(0, 300);
+    for (size_t i = 0; i < frames; ++i) {
+        for (size_t c = 0; c < channels; ++c) {
+            double t = static_cast<double>(i) / header.sampleRate;
+            double value = 8000 * std::sin(2 * M_PI * (440 + 110 * c) * t) +
+                           3000 * std::sin(2 * M_PI * 3150 * t) + noise(random);
+            uint32_t sample = static_cast<uint32_t>(static_cast<int32_t>(value * scale));
+            for (size_t b = 0; b < bits / 8; ++b) {
+                *data++ = static_cast<char>(sample >> (8 * b));
+            }
+        }
+    }
+    return true;
+}
+
+/* one object of the "files" array: decode, compress and encode as the
+ * whole-file mode of vhWawCompressor does, throughput of the input bytes;
+ * every stage reports its own fastest run */
+template <typename T>
+std::string benchFile(const std::string& source, const std::string& result, const BenchOptions& options) {
+    double decode_seconds = HUGE_VAL;
+    double compress_seconds = HUGE_VAL;
+    double encode_seconds = HUGE_VAL;
+    size_t bytes = 0;
+    size_t channels = 0;
+    size_t bits = 0;
+    double total = fastestSeconds(options.seconds, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        WavFile file;
+        if (!file.open(source)) {
+            return;
+        }
+        const WAVHEADER& header = file.header();
+        size_t frames = file.frames();
+        bytes = file.dataSize();
+        channels = header.numChannels;
+        bits = header.bitsPerSample;
+        std::vector<std::vector<T>> data(header.numChannels);
+        for (auto& channel : data) {
+            channel.reserve(frames + 2);
+        }
+        decodeChannels(file.data(), frames, &header, data);
+        auto decoded = std::chrono::steady_clock::now();
+
+        RealFftPlan<T> plan(frames);
+        for (auto& channel : data) {
+            commpressData(channel, plan, 20);
+        }
+        auto compressed = std::chrono::steady_clock::now();
+
+        WavFile target;
+        if (!target.create(result, header, frames * header.blockAlign)) {
+            return;
+        }
+        encodeChannels(data, &target.header(), target.data(), false);
+        target.close();
+        auto encoded = std::chrono::steady_clock::now();
+
+        decode_seconds = std::min(decode_seconds, std::chrono::duration<double>(decoded - start).count());
+        compress_seconds = std::min(compress_seconds, std::chrono::duration<double>(compressed - decoded).count());
+        encode_seconds = std::min(encode_seconds, std::chrono::duration<double>(encoded - compressed).count());
+    });
+
+    double megabytes = bytes / 1e6;
+    std::ostringstream out;
+    out << "{\"precision\": \"" << (sizeof(T) == sizeof(float) ? "float" : "double") << "\""
+        << ", \"channels\": " << channels
+        << ", \"bits\": " << bits
+        << ", \"bytes\": " << bytes
+        << ", \"seconds\": " << total
+        << ", \"mb_per_s\": " << megabytes / total
+        << ", \"decode_mb_per_s\": " << megabytes / decode_seconds
+        << ", \"compress_mb_per_s\": " << megabytes / compress_seconds
+        << ", \"encode_mb_per_s\": " << megabytes / encode_seconds
+        << ", \"peak_rss\": " << peakRss() << "}";
+    return out.str();
+}
+
+int main(int argc, char** argv) {
+
+    BenchOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        std::cout << "WRONG ARGUMENTS, try: " << USAGE << std::endl;
+        return 0;
+    }
+    setFftThreads(options.threads);
+
+    std::vector<std::string> transforms;
+    for (size_t log_n = options.min_log; log_n <= options.max_log; ++log_n) {
+        transforms.push_back(benchTransforms<float>(log_n, options));
+        transforms.push_back(benchTransforms<double>(log_n, options));
+        std::cerr << "2^" << log_n << " done" << std::endl;
+    }
+
+    std::vector<std::string> files;
+    if (options.wav_frames > 0) {
+        std::string directory = P_tmpdir;
+        /* mono 16-bit is read densely, stereo and 24-bit are de-interleaved */
+        for (auto format : {std::make_pair(1, 16), std::make_pair(2, 16), std::make_pair(2, 24)}) {
+            std::string source = directory + "/bench_fft_source.wav";
+            std::string result = directory + "/bench_fft_result.wav";
+            if (!writeSyntheticWav(source, options.wav_frames, format.first, format.second)) {
+                return 0;
+            }
+            files.push_back(benchFile<float>(source, result, options));
+            files.push_back(benchFile<double>(source, result, options));
+            std::remove(source.c_str());
+            std::remove(result.c_str());
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"threads\": " << options.threads << ",\n  \"transforms\": [";
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        json << (i ? ",\n    " : "\n    ") << transforms[i];
+    }
+    json << "\n  ],\n  \"files\": [";
+    for (size_t i = 0; i < files.size(); ++i) {
+        json << (i ? ",\n    " : "\n    ") << files[i];
+    }
+    json << "\n  ],\n  \"peak_rss\": " << peakRss() << "\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(options.output);
+        out << json.str();
+        if (!out) {
+            perror("Failed write file");
+        }
+    }
+
+    return 0;
+}
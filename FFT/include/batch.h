@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/* Batch compression of many WAV files. Every file goes through
+ *   read -> decode -> compress -> encode and write
+ * where each arrow is a bounded queue and every stage has its own thread,
+ * so reading the next file and writing the previous one overlap with the
+ * transforms. The compress stage runs on `workers` threads, each of them
+ * takes a whole file; a queue never holds more than a few files, so memory
+ * stays bounded however long the list is. */
+struct BatchOptions {
+    size_t workers = 1;
+    /* share of spectrum bins kept, as in commpressData */
+    char percents = 20;
+    /* TPDF dither before requantizing to integer samples */
+    bool dither = false;
+};
+
+/* a directory gives its *.wav and *.waw files in name order, anything else
+ * is read as a manifest with one path per line, empty lines are skipped */
+bool listBatchSources(const std::string& input, std::vector<std::string>& sources);
+
+/* results get the names of their sources inside result_directory,
+ * which is created if needed; a source that would be overwritten by its
+ * result is skipped; returns the number of files that failed, the reason
+ * of every failure is reported through perror */
+template <typename T>
+size_t runBatch(const std::vector<std::string>& sources, const std::string& result_directory,
+                const BatchOptions& options);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#include "wav.h"
+
+/* Compressed container. Every channel goes through a sine-window MDCT
+ * (frames of frame_size samples, hop frame_size / 2), only the largest
+ * `percents` percent of each frame's coefficients are kept like in
+ * commpressData, they are quantized with a uniform step and Huffman coded.
+ *
+ * Layout, little-endian:
+ *   "VHWC", u16 version, u16 audioFormat, u16 numChannels, u16 bitsPerSample,
+ *   u32 sampleRate, u64 frames per channel, u32 hop, f32 quantizer step,
+ *   then blocks of up to CODEC_BLOCK_FRAMES MDCT frames:
+ *   u32 block bytes after this field, u32 MDCT frames in the block,
+ *   code lengths of the symbols (two per byte), the bit stream.
+ * Inside a block the frames go one after another, each frame holds every
+ * channel in turn, each channel is a run of coefficients ended by EOB.
+ * A coefficient q is the symbol bitLength(|q|) followed by the bits of |q|
+ * below the leading one and the sign. */
+
+struct CodecOptions {
+    /* MDCT frame, a multiple of four */
+    size_t frame_size = 2048;
+    /* the quantizer step is 2^(1 - bits) of full scale */
+    int bits = 16;
+    /* share of coefficients kept in every frame */
+    char percents = 20;
+};
+
+/* MDCT frames coded with one Huffman table */
+const size_t CODEC_BLOCK_FRAMES = 32;
+
+/* encodes the whole source into the container, errors are reported through perror */
+template <typename T>
+bool compressFile(WavFile& source, const std::string& result, const CodecOptions& options);
+
+/* rebuilds a WAV in the source format, dither as in encodeChannels */
+template <typename T>
+bool decompressFile(const std::string& source, const std::string& result, bool dither);
@@ -1,11 +1,246 @@
+#pragma once
+
 #include <cmath>
 #include <complex>
 #include <cstdio>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
-void fftStraight(std::vector<std::complex<double>>& data);
+template <typename T>
+struct FftKernels;
+
+class ThreadPool;
+
+/* Precomputed tables for an in-place FFT of a fixed size n over float or
+ * double (the library is instantiated for both). The plan is built once and
+ * serves any number of transforms in both directions without further
+ * allocations.
+ * Powers of two run iterative radix-2/4 stages on split real/imaginary
+ * arrays with the widest SIMD kernel the CPU supports (VH_FFT_KERNEL forces
+ * scalar/sse2/avx2/avx512), other sizes made of factors 2, 3, 5 and 7 run
+ * mixed-radix stages and any other size goes through Bluestein's chirp-z
+ * convolution on a power of two plan. Large sizes of the first two kinds
+ * are split by the four-step algorithm into cache-sized row transforms and
+ * an in-place transpose, which run on the FFT thread pool (see
+ * setFftThreads) and need no scratch of the size of the data. These are the
+ * defaults; with tuning on or loaded wisdom the choice is made per size
+ * (see setFftTuning). */
+template <typename T = double>
+class FftPlan {
+public:
+
+    explicit FftPlan(size_t n);
+
+    size_t size() const;
+
+    const char* kernelName() const;
+
+    void forward(std::vector<std::complex<T>>& data) const;
+
+    void inverse(std::vector<std::complex<T>>& data) const;
+
+    void transform(std::complex<T>* data, bool reversed) const;
+
+    /* in-place transform of data already stored as split arrays */
+    void transform(T* re, T* im, bool reversed) const;
+
+private:
+
+    enum class Strategy {
+        Radix2,
+        MixedRadix,
+        Bluestein,
+        FourStep
+    };
+
+    /* how a size is transformed */
+    struct Choice {
+        const FftKernels<T>* kernels;
+        Strategy strategy;
+        /* four-step passes run on the FFT pool or on the calling thread */
+        bool parallel;
+    };
+
+    FftPlan(size_t n, const Choice& choice);
+
+    static const char* strategyName(Strategy strategy);
+
+    /* whether the strategy can transform n values */
+    static bool usable(size_t n, Strategy strategy);
+
+    /* wisdom for n, otherwise the fastest candidate if tuning is on,
+     * otherwise the fixed defaults */
+    static Choice choose(size_t n);
+
+    static Choice tune(size_t n);
+
+    ThreadPool& pool() const;
+
+    void initRadix2();
+
+    void initMixedRadix();
+
+    void initBluestein();
+
+    void initFourStep();
+
+    /* forward transform of already permuted split data */
+    void runForward(T* re, T* im) const;
+
+    void runStages(T* re, T* im) const;
+
+    void runMixedStages(T* re, T* im) const;
+
+    void runBluestein(T* re, T* im) const;
+
+    void runFourStep(T* re, T* im) const;
+
+    void runFourStepPasses(T* re, T* im, size_t step, T scale) const;
+
+    size_t n_;
+    Strategy strategy_;
+    /* data[i] is taken from input[permutation_[i]] before the stages run
+     * (bit reversal or its mixed-radix analogue, empty for Bluestein) */
+    std::vector<size_t> permutation_;
+    /* radix-2: w[half + j] = exp(2*pi*i * j / (2 * half)) for every stage;
+     * mixed radix: w_L^(r*k) for every stage of length L = p * m,
+     * 1 <= r < p, k < m, stored stage after stage;
+     * four-step: w_n^l for l < rows followed by w_n^(h * rows)
+     * for h < columns, their product gives any w_n^(j * k) */
+    std::vector<T> twiddles_re_;
+    std::vector<T> twiddles_im_;
+    /* mixed-radix factors, the outermost stage first */
+    std::vector<size_t> factors_;
+    /* Bluestein: chirp exp(pi*i * j^2 / n), the spectrum of its conjugate
+     * and the power of two plan for the convolution */
+    std::vector<T> chirp_re_;
+    std::vector<T> chirp_im_;
+    std::vector<T> kernel_re_;
+    std::vector<T> kernel_im_;
+    std::unique_ptr<FftPlan<T>> inner_;
+    /* four-step: n = rows * columns (rows a multiple of columns), column
+     * transforms have length rows and row transforms length columns */
+    size_t rows_;
+    size_t columns_;
+    std::unique_ptr<FftPlan<T>> row_plan_;
+    std::unique_ptr<FftPlan<T>> column_plan_;
+    const FftKernels<T>* kernels_;
+    bool parallel_;
+
+};
+
+/* Transform of n real samples. For even n it goes through a complex FFT of
+ * size n / 2, odd sizes fall back to a full complex transform. Only the
+ * non-redundant half of the Hermitian spectrum is stored: n / 2 + 1 bins.
+ * The spectrum may alias the sample buffer (then the buffer must hold
+ * n + 2 values), which makes the transform in-place. */
+template <typename T = double>
+class RealFftPlan {
+public:
+
+    explicit RealFftPlan(size_t n);
+
+    size_t size() const;
+
+    size_t spectrumSize() const;
+
+    void forward(const T* samples, std::complex<T>* spectrum) const;
+
+    void inverse(const std::complex<T>* spectrum, T* samples) const;
+
+private:
+
+    /* exp(2*pi*i * k / n) for k <= n / 4 */
+    std::complex<T> twiddle(size_t k) const;
+
+    size_t n_;
+    /* size n / 2 for even n, n for odd n */
+    FftPlan<T> plan_;
+    /* exp(2*pi*i * l / n) for l < 2^fine_bits_ followed by
+     * exp(2*pi*i * h * 2^fine_bits_ / n); small sizes get the whole range
+     * in the first part and a single coarse value of 1 */
+    size_t fine_bits_;
+    std::vector<std::complex<T>> twiddles_;
+
+};
+
+/* The smallest even length from n on whose real transform needs no
+ * Bluestein convolution (n / 2 made of factors 2, 3, 5 and 7): the
+ * convolution takes several buffers of twice the length, so zero-padding
+ * to this size, 2% at most from 20000 samples on, is far cheaper. */
+size_t fastRealFftSize(size_t n);
+
+/* The transform length used to compress n samples as one signal; every
+ * whole-signal path (commpressData without a plan, whole-file and batch
+ * modes) takes its plan size from here, so they give the same result. */
+size_t compressionFftSize(size_t n);
+
+/* The length of the reduced transform that decimates n samples by k: at
+ * least ceil(n / k) and fast; the forward transform is k times longer. */
+size_t decimationFftSize(size_t n, size_t k);
+
+/* Number of threads used by large transforms, 1 by default.
+ * Must not be changed while transforms are running. */
+void setFftThreads(size_t threads);
+
+size_t fftThreads();
+
+/* The pool behind setFftThreads. Independent jobs such as channels run on it
+ * too: transforms started from its tasks share the same threads. */
+ThreadPool& fftThreadPool();
+
+/* With tuning on, the first plan of every size times the strategies that
+ * can transform it (radix-2 stages with each kernel the CPU supports or
+ * mixed-radix stages, four-step, Bluestein) and, for four-step, the thread
+ * pool against the calling thread alone, and keeps the fastest.
+ * The winners ("wisdom") are remembered per precision, size and FFT thread
+ * count. Loaded wisdom is used whether tuning is on or not; a kernel forced
+ * by VH_FFT_KERNEL takes precedence over it. Off by default. */
+void setFftTuning(bool enabled);
+
+/* adds the entries of a wisdom file, false if it cannot be read;
+ * a missing file is not reported, lines of other hosts' kernels are ignored */
+bool loadFftWisdom(const std::string& path);
+
+/* writes every known entry, creating the directory; errors go through perror */
+bool saveFftWisdom(const std::string& path);
+
+/* $VH_FFT_WISDOM, else $XDG_CACHE_HOME/vhWawCompressor/wisdom,
+ * else ~/.cache/vhWawCompressor/wisdom */
+std::string defaultFftWisdomPath();
+
+template <typename T>
+void fftStraight(std::vector<std::complex<T>>& data);
+
+template <typename T>
+void fftReversed(std::vector<std::complex<T>>& data);
+
+/* Zeroes every value except the `percents` percent with the largest
+ * magnitude (at least one while percents > 0). The threshold is found with
+ * nth_element, so the cost is linear. V is T or std::complex<T>. */
+template <typename V>
+void keepLargest(V* values, size_t count, char percents);
+
+/* the spectrum keeps its `percents` percent of largest bins */
+template <typename T>
+void commpressData(std::vector<std::complex<T>>& data, char percents = 20);
+
+template <typename T>
+void commpressData(std::vector<T>& data, char percents = 20);
 
-void fftReversed(std::vector<std::complex<double>>& data);
+/* the same with a prepared plan of at least data.size() samples (a longer
+ * one zero-pads the data, the result keeps its length); plans are read-only
+ * during transforms, so one plan serves any number of threads */
+template <typename T>
+void commpressData(std::vector<T>& data, const RealFftPlan<T>& plan, char percents = 20);
 
-void commpressData(std::vector<std::complex<double>>& data, char percents = 20);
+/* Band-limited reduction to ceil(n / k) samples, i.e. the sample rate
+ * divided by k: the data is zero-padded to plan.size() = k * target.size()
+ * samples (target.size() at least ceil(n / k), see decimationFftSize), the
+ * spectrum is cut at the new Nyquist frequency, the largest `percents`
+ * percent of the remaining bins are kept as in commpressData and the
+ * inverse transform of the shorter length gives the decimated signal. */
+template <typename T>
+void decimateData(std::vector<T>& data, const RealFftPlan<T>& plan, const RealFftPlan<T>& target, char percents = 20);
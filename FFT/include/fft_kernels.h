@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include "simd.h"
+
+/* Butterfly kernels over split real/imaginary arrays.
+ * Every kernel performs exactly the same floating point operations in the
+ * same order (the library is built with -ffp-contract=off), so the vector
+ * versions give bit-identical results to the scalar one. */
+template <typename T>
+struct FftKernels {
+    const char* name;
+    /* one radix-2 stage over blocks of 2 * half,
+     * twiddles are taken from w_re/w_im[half .. 2 * half) */
+    void (*radix2)(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t half);
+    /* stages half and 2 * half fused into one radix-4 pass over the data */
+    void (*radix4)(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t half);
+};
+
+template <typename T>
+const FftKernels<T>& scalarFftKernels();
+
+template <typename T>
+const FftKernels<T>& sse2FftKernels();
+
+template <typename T>
+const FftKernels<T>& avx2FftKernels();
+
+template <typename T>
+const FftKernels<T>& avx512FftKernels();
+
+template <typename Isa, typename V>
+inline void butterfly(V& a_re, V& a_im, V& b_re, V& b_im, const V& w_re, const V& w_im) {
+    V t_re = w_re * b_re - w_im * b_im;
+    V t_im = w_re * b_im + w_im * b_re;
+    b_re = a_re - t_re;
+    b_im = a_im - t_im;
+    a_re = a_re + t_re;
+    a_im = a_im + t_im;
+}
+
+template <typename Isa, typename V, typename T>
+inline V loadLanes(const T* p) {
+    V v;
+    std::memcpy(&v, p, sizeof(V));
+    return v;
+}
+
+template <typename Isa, typename V, typename T>
+inline void storeLanes(T* p, const V& v) {
+    std::memcpy(p, &v, sizeof(V));
+}
+
+/* V is either T itself (step 1) or a vector of T (step = lanes) */
+template <typename Isa, typename V, typename T>
+inline void radix2Loop(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t half, size_t step) {
+    for (size_t start = 0; start < n; start += 2 * half) {
+        T* a_re = re + start;
+        T* a_im = im + start;
+        T* b_re = a_re + half;
+        T* b_im = a_im + half;
+        for (size_t j = 0; j < half; j += step) {
+            V ar = loadLanes<Isa, V>(a_re + j);
+            V ai = loadLanes<Isa, V>(a_im + j);
+            V br = loadLanes<Isa, V>(b_re + j);
+            V bi = loadLanes<Isa, V>(b_im + j);
+            butterfly<Isa>(ar, ai, br, bi, loadLanes<Isa, V>(w_re + half + j), loadLanes<Isa, V>(w_im + half + j));
+            storeLanes<Isa>(a_re + j, ar);
+            storeLanes<Isa>(a_im + j, ai);
+            storeLanes<Isa>(b_re + j, br);
+            storeLanes<Isa>(b_im + j, bi);
+        }
+    }
+}
+
+template <typename Isa, typename V, typename T>
+inline void radix4Loop(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t q, size_t step) {
+    for (size_t start = 0; start < n; start += 4 * q) {
+        T* p_re = re + start;
+        T* p_im = im + start;
+        for (size_t j = 0; j < q; j += step) {
+            V ar = loadLanes<Isa, V>(p_re + j);
+            V ai = loadLanes<Isa, V>(p_im + j);
+            V br = loadLanes<Isa, V>(p_re + q + j);
+            V bi = loadLanes<Isa, V>(p_im + q + j);
+            V cr = loadLanes<Isa, V>(p_re + 2 * q + j);
+            V ci = loadLanes<Isa, V>(p_im + 2 * q + j);
+            V dr = loadLanes<Isa, V>(p_re + 3 * q + j);
+            V di = loadLanes<Isa, V>(p_im + 3 * q + j);
+
+            V w1_re = loadLanes<Isa, V>(w_re + q + j);
+            V w1_im = loadLanes<Isa, V>(w_im + q + j);
+            butterfly<Isa>(ar, ai, br, bi, w1_re, w1_im);
+            butterfly<Isa>(cr, ci, dr, di, w1_re, w1_im);
+
+            butterfly<Isa>(ar, ai, cr, ci, loadLanes<Isa, V>(w_re + 2 * q + j), loadLanes<Isa, V>(w_im + 2 * q + j));
+            butterfly<Isa>(br, bi, dr, di, loadLanes<Isa, V>(w_re + 3 * q + j), loadLanes<Isa, V>(w_im + 3 * q + j));
+
+            storeLanes<Isa>(p_re + j, ar);
+            storeLanes<Isa>(p_im + j, ai);
+            storeLanes<Isa>(p_re + q + j, br);
+            storeLanes<Isa>(p_im + q + j, bi);
+            storeLanes<Isa>(p_re + 2 * q + j, cr);
+            storeLanes<Isa>(p_im + 2 * q + j, ci);
+            storeLanes<Isa>(p_re + 3 * q + j, dr);
+            storeLanes<Isa>(p_im + 3 * q + j, di);
+        }
+    }
+}
+
+/* stages narrower than one vector fall back to the scalar loop */
+template <typename T, typename Isa>
+void radix2Pass(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t half) {
+    if constexpr (Isa::bytes > sizeof(T)) {
+        typedef T V __attribute__((vector_size(Isa::bytes)));
+        constexpr size_t lanes = Isa::bytes / sizeof(T);
+        if (half >= lanes) {
+            radix2Loop<Isa, V>(re, im, w_re, w_im, n, half, lanes);
+            return;
+        }
+    }
+    radix2Loop<Isa, T>(re, im, w_re, w_im, n, half, 1);
+}
+
+template <typename T, typename Isa>
+void radix4Pass(T* re, T* im, const T* w_re, const T* w_im, size_t n, size_t q) {
+    if constexpr (Isa::bytes > sizeof(T)) {
+        typedef T V __attribute__((vector_size(Isa::bytes)));
+        constexpr size_t lanes = Isa::bytes / sizeof(T);
+        if (q >= lanes) {
+            radix4Loop<Isa, V>(re, im, w_re, w_im, n, q, lanes);
+            return;
+        }
+    }
+    radix4Loop<Isa, T>(re, im, w_re, w_im, n, q, 1);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <complex>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fft.h"
+
+/* A FIR filter prepared for overlap-save convolution: the taps are
+ * zero-padded to a block of a power of two, at least four times their
+ * count, and transformed once. It is read-only, so the filters of all
+ * channels can share one response. */
+template <typename T = double>
+class FirResponse {
+public:
+
+    explicit FirResponse(const std::vector<T>& taps);
+
+    size_t taps() const;
+
+    size_t blockSize() const;
+
+    /* new samples consumed by one block: blockSize() - taps() + 1 */
+    size_t step() const;
+
+    const RealFftPlan<T>& plan() const;
+
+    /* plan().spectrumSize() bins, scaled so that an inverse transform
+     * of the product gives the convolution */
+    const std::complex<T>* spectrum() const;
+
+private:
+
+    size_t taps_;
+    RealFftPlan<T> plan_;
+    std::vector<std::complex<T>> spectrum_;
+
+};
+
+/* Streaming overlap-save filter: each block is the last taps - 1 samples
+ * followed by step() new ones. After the block is transformed and multiplied
+ * by the response, the first taps - 1 outputs are circular garbage and the
+ * rest are exact. The cost per sample is that of a few FFTs per block,
+ * however long the filter. Output is advanced by (taps - 1) / 2 samples,
+ * which removes the delay of a symmetric (linear-phase) filter, and has
+ * exactly as many samples as the input. */
+template <typename T = double>
+class OverlapSaveFilter {
+public:
+
+    explicit OverlapSaveFilter(std::shared_ptr<const FirResponse<T>> response);
+
+    /* appends every output sample that is already known */
+    void push(const T* samples, size_t count, std::vector<T>& out);
+
+    /* flushes the rest, the input is continued by zeros */
+    void finish(std::vector<T>& out);
+
+private:
+
+    void processBlock(std::vector<T>& out);
+
+    std::shared_ptr<const FirResponse<T>> response_;
+    /* taps - 1 samples of history followed by filled_ new ones */
+    std::vector<T> input_;
+    size_t filled_;
+    /* block size + 2 values, the spectrum is computed in place */
+    std::vector<T> block_;
+    /* outputs before the delay-compensated start */
+    size_t skip_;
+    size_t pushed_;
+    size_t produced_;
+    /* input samples reported to the stage counters, as in StftCompressor */
+    size_t counted_;
+
+};
+
+/* A gain as a function of frequency: points (Hz, gain) in increasing
+ * frequency, linear in between and constant outside. */
+typedef std::vector<std::pair<double, double>> FrequencyResponse;
+
+/* Linear-phase filter of `taps` taps (rounded up to odd) by frequency
+ * sampling: the response is sampled on a fine grid, transformed back and
+ * cut to the taps with a Blackman window. */
+template <typename T>
+std::vector<T> designFir(const FrequencyResponse& response, double sample_rate, size_t taps);
+
+/* "lowpass:F", "highpass:F", "bandpass:F1:F2", "bandstop:F1:F2" or
+ * points "F:G,F:G,..."; false if the spec is malformed */
+bool parseFrequencyResponse(const std::string& spec, FrequencyResponse& response);
+
+/* whitespace separated taps from a text file, errors go through perror */
+bool readFirTaps(const std::string& path, std::vector<double>& taps);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include "fft.h"
+
+/* Orthonormal MDCT with a sine window, the lapped transform used by the
+ * compressed container. A frame of 2 * hop samples gives hop coefficients,
+ * consecutive frames overlap by hop samples, and overlap-adding the inverse
+ * of neighbouring frames restores the signal exactly (TDAC). Internally the
+ * frame is folded into a DCT-IV of size hop, computed by a complex FFT of
+ * size hop / 2. The plan keeps its own scratch, so use one per thread. */
+template <typename T = double>
+class MdctPlan {
+public:
+
+    /* hop must be even */
+    explicit MdctPlan(size_t hop);
+
+    size_t hop() const;
+
+    /* 2 * hop samples -> hop coefficients, the window is applied here */
+    void forward(const T* samples, T* coefficients);
+
+    /* hop coefficients -> 2 * hop windowed samples, to be added to
+     * the second half of the previous frame */
+    void inverse(const T* coefficients, T* samples);
+
+private:
+
+    /* in-place DCT-IV of folded_ scaled by sqrt(2 / hop) */
+    void dct4();
+
+    size_t hop_;
+    FftPlan<T> plan_;
+    std::vector<T> window_;
+    /* exp(-i pi n / hop) before the FFT and
+     * exp(-i pi (4k + 1) / (4 hop)) with the scale after it */
+    std::vector<std::complex<T>> pre_twiddles_;
+    std::vector<std::complex<T>> post_twiddles_;
+    std::vector<T> folded_;
+    std::vector<std::complex<T>> buffer_;
+
+};
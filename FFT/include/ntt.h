@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Arithmetic modulo an odd p < 2^31 in Montgomery form: x is kept as
+ * x * 2^32 mod p, so a product needs two multiplications and a shift
+ * instead of a division. */
+struct Montgomery {
+    uint32_t modulus;
+    /* -modulus^(-1) mod 2^32 */
+    uint32_t negated_inverse;
+    /* 2^64 mod modulus, brings a value into the form */
+    uint32_t r2;
+
+    explicit Montgomery(uint32_t p) : modulus(p) {
+        uint32_t inverse = p;
+        /* Newton iteration, every step doubles the correct low bits */
+        for (int i = 0; i < 4; ++i) {
+            inverse *= 2 - p * inverse;
+        }
+        negated_inverse = -inverse;
+        r2 = static_cast<uint32_t>((static_cast<unsigned __int128>(1) << 64) % p);
+    }
+
+    /* t * 2^(-32) mod p for t < p * 2^32 */
+    uint32_t reduce(uint64_t t) const {
+        uint32_t m = static_cast<uint32_t>(t) * negated_inverse;
+        uint32_t r = static_cast<uint32_t>((t + static_cast<uint64_t>(m) * modulus) >> 32);
+        return r >= modulus ? r - modulus : r;
+    }
+
+    /* when one factor is in the form and the other is not, the result is not */
+    uint32_t multiply(uint32_t a, uint32_t b) const {
+        return reduce(static_cast<uint64_t>(a) * b);
+    }
+
+    uint32_t toForm(uint32_t a) const {
+        return multiply(a, r2);
+    }
+
+    uint32_t fromForm(uint32_t a) const {
+        return reduce(a);
+    }
+};
+
+/* Reduction of any 64-bit value modulo a fixed p with one high
+ * multiplication by the precomputed 2^64 / p. */
+struct Barrett {
+    uint64_t modulus;
+    uint64_t factor;
+
+    explicit Barrett(uint64_t p) : modulus(p), factor(~uint64_t(0) / p) {}
+
+    uint64_t reduce(uint64_t x) const {
+        uint64_t q = static_cast<uint64_t>((static_cast<unsigned __int128>(x) * factor) >> 64);
+        uint64_t r = x - q * modulus;
+        return r >= modulus ? r - modulus : r;
+    }
+};
+
+/* Number theoretic transform of a power of two size n over the prime field
+ * modulo p, where root generates the multiplicative group and n divides
+ * p - 1. The structure is that of the radix-2 FftPlan: a bit-reversal
+ * permutation and log2(n) butterfly stages with per-stage twiddles, here
+ * products are exact. The plan is read-only during transforms. */
+class NttPlan {
+public:
+
+    NttPlan(uint32_t modulus, uint32_t root, size_t n);
+
+    size_t size() const;
+
+    uint32_t modulus() const;
+
+    /* in place, values in [0, modulus) */
+    void forward(uint32_t* data) const;
+
+    /* in place, scaled by 1 / n so it undoes forward */
+    void inverse(uint32_t* data) const;
+
+private:
+
+    void run(uint32_t* data, const std::vector<uint32_t>& twiddles) const;
+
+    Montgomery arithmetic_;
+    size_t n_;
+    std::vector<size_t> permutation_;
+    /* w[half + j] = w_(2 half)^j in Montgomery form, as in FftPlan */
+    std::vector<uint32_t> twiddles_;
+    std::vector<uint32_t> inverse_twiddles_;
+    /* 1 / n in Montgomery form */
+    uint32_t scale_;
+
+};
+
+/* primes c * 2^k + 1 with their generators, transforms up to 2^24 fit all three */
+const uint32_t NTT_PRIMES[3] = {2013265921, 469762049, 754974721};
+const uint32_t NTT_ROOTS[3] = {31, 3, 11};
+const size_t NTT_MAX_SIZE = size_t(1) << 24;
+
+/* c[k] = sum a[i] * b[k - i] modulo one of NTT_PRIMES */
+std::vector<uint32_t> convolveModulo(
+    const std::vector<uint32_t>& a,
+    const std::vector<uint32_t>& b,
+    size_t prime
+);
+
+/* Exact convolution of unsigned 64-bit sequences, reduced modulo 2^64 like
+ * native arithmetic. The transform is done modulo all three primes (on the
+ * FFT thread pool) and recombined by CRT, which is exact while every true
+ * coefficient is below their product, about 2^89: e.g. values below 2^32
+ * and the shorter input below 2^24. Short inputs are multiplied directly. */
+std::vector<uint64_t> convolve(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b);
+
+/* Product of two non-negative numbers stored as little-endian base 2^32
+ * limbs; the result has no leading zero limbs (empty for zero). */
+std::vector<uint32_t> multiplyBig(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "simd.h"
+#include "wav.h"
+
+/* Sample converters between interleaved little-endian PCM and planar T.
+ * stride is the distance between two samples of one channel in bytes,
+ * i.e. blockAlign of the file. Mono and stereo channels work on whole
+ * vectors (8-bit excepted), other layouts walk the frames one by one. */
+template <typename T>
+struct PcmKernels {
+    const char* name;
+    /* dst[i] = sample at src + i * stride scaled to [-1, 1) */
+    void (*decode[SAMPLE_FORMAT_COUNT])(const char* src, size_t stride, size_t count, T* dst);
+    /* the inverse with rounding to nearest and saturation,
+     * dither (in units of the last bit) is added before rounding if given */
+    void (*encode[SAMPLE_FORMAT_COUNT])(const T* src, const T* dither, size_t count, char* dst, size_t stride);
+};
+
+template <typename T>
+const PcmKernels<T>& scalarPcmKernels();
+
+template <typename T>
+const PcmKernels<T>& avx2PcmKernels();
+
+/* storage and scale of every sample format */
+struct UInt8Sample {
+    typedef uint8_t Storage;
+    static constexpr size_t bytes = 1;
+    static constexpr bool integral = true;
+    static constexpr double full_scale = 128.0;
+    static constexpr int64_t min = -128;
+    static constexpr int64_t max = 127;
+};
+
+struct Int16Sample {
+    typedef int16_t Storage;
+    static constexpr size_t bytes = 2;
+    static constexpr bool integral = true;
+    static constexpr double full_scale = 32768.0;
+    static constexpr int64_t min = -32768;
+    static constexpr int64_t max = 32767;
+};
+
+struct Int24Sample {
+    typedef int32_t Storage;
+    static constexpr size_t bytes = 3;
+    static constexpr bool integral = true;
+    static constexpr double full_scale = 8388608.0;
+    static constexpr int64_t min = -8388608;
+    static constexpr int64_t max = 8388607;
+};
+
+struct Int32Sample {
+    typedef int32_t Storage;
+    static constexpr size_t bytes = 4;
+    static constexpr bool integral = true;
+    static constexpr double full_scale = 2147483648.0;
+    static constexpr int64_t min = -2147483648LL;
+    static constexpr int64_t max = 2147483647LL;
+};
+
+struct Float32Sample {
+    typedef float Storage;
+    static constexpr size_t bytes = 4;
+    static constexpr bool integral = false;
+    static constexpr double full_scale = 1.0;
+    static constexpr int64_t min = -1;
+    static constexpr int64_t max = 1;
+};
+
+/* 8-bit WAV is unsigned with the zero at 128, 24-bit is packed into three bytes */
+template <typename Sample>
+inline typename Sample::Storage loadSample(const char* p) {
+    if constexpr (std::is_same<Sample, UInt8Sample>::value) {
+        return static_cast<uint8_t>(*p);
+    } else if constexpr (std::is_same<Sample, Int24Sample>::value) {
+        const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+        uint32_t bits = (uint32_t(b[0]) << 8) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 24);
+        return static_cast<int32_t>(bits) >> 8;
+    } else {
+        typename Sample::Storage value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+}
+
+template <typename Sample>
+inline void storeSample(char* p, typename Sample::Storage value) {
+    if constexpr (std::is_same<Sample, Int24Sample>::value) {
+        uint32_t bits = static_cast<uint32_t>(value);
+        p[0] = static_cast<char>(bits);
+        p[1] = static_cast<char>(bits >> 8);
+        p[2] = static_cast<char>(bits >> 16);
+    } else {
+        std::memcpy(p, &value, sizeof(value));
+    }
+}
+
+/* the largest T not above the integer limit, float cannot hold 2^31 - 1 */
+template <typename T>
+inline T sampleLimit(int64_t limit) {
+    T value = static_cast<T>(limit);
+    if (limit > 0 && static_cast<long double>(value) > limit) {
+        value = std::nextafter(value, T(0));
+    }
+    return value;
+}
+
+template <typename Sample, typename T>
+inline T decodeValue(typename Sample::Storage value) {
+    if constexpr (std::is_same<Sample, UInt8Sample>::value) {
+        return (T(value) - T(128)) * T(1 / Sample::full_scale);
+    } else {
+        return T(value) * T(1 / Sample::full_scale);
+    }
+}
+
+template <typename Sample, typename T>
+inline typename Sample::Storage encodeValue(T value, T dither, T lo, T hi) {
+    if constexpr (!Sample::integral) {
+        return static_cast<typename Sample::Storage>(value);
+    } else {
+        T v = value * T(Sample::full_scale) + dither;
+        v += v < T(0) ? T(-0.5) : T(0.5);
+        v = v < lo ? lo : v;
+        v = v > hi ? hi : v;
+        int64_t rounded = static_cast<int64_t>(v);
+        if constexpr (std::is_same<Sample, UInt8Sample>::value) {
+            rounded += 128;
+        }
+        return static_cast<typename Sample::Storage>(rounded);
+    }
+}
+
+/* UInt8 has no matching vector lane type, Int24 is widened to 32-bit lanes */
+template <typename Sample>
+constexpr bool vectorSample() {
+    return !std::is_same<Sample, UInt8Sample>::value;
+}
+
+/* Converts whole vectors of a channel whose samples are `channels` samples
+ * apart and returns how many samples it converted. Dense 16/32-bit lanes
+ * are copied at once. A stereo frame is read as one integer of twice the
+ * sample width whose low half is this channel (little-endian): 16-bit
+ * lanes are sign-extended from it by shifts, 32-bit ones split off by a
+ * narrowing conversion. A 24-bit lane is gathered as four bytes and
+ * sign-extended from the low three. Frames and 24-bit lanes read past the
+ * sample, so their last vector stops one sample short of count and the
+ * extra bytes stay inside the data. 16-bit lanes are widened to 32 bits
+ * before the conversion to T, which the instruction sets do directly. */
+template <typename T, typename Isa, typename Sample, size_t channels>
+size_t decodeVectors(const char* src, size_t count, T* dst) {
+    typedef typename Sample::Storage S;
+    constexpr size_t lanes = Isa::bytes / sizeof(T);
+    constexpr size_t stride = channels * Sample::bytes;
+    constexpr bool packed24 = Sample::bytes < sizeof(S);
+    typedef T V __attribute__((vector_size(Isa::bytes)));
+    typedef S VS __attribute__((vector_size(lanes * sizeof(S))));
+    typedef int32_t VI __attribute__((vector_size(lanes * sizeof(int32_t))));
+    typedef typename std::conditional<sizeof(S) == 2, uint16_t, uint32_t>::type U;
+    typedef typename std::conditional<sizeof(S) == 2, uint32_t, uint64_t>::type Frame;
+    typedef U VU __attribute__((vector_size(lanes * sizeof(U))));
+    typedef Frame VF __attribute__((vector_size(lanes * sizeof(Frame))));
+    const T scale = T(1 / Sample::full_scale);
+    size_t i = 0;
+    for (; i + lanes + (channels > 1 || packed24 ? 1 : 0) <= count; i += lanes) {
+        V values;
+        if constexpr (channels == 2 && sizeof(S) == 2) {
+            VI frames;
+            std::memcpy(&frames, src + i * stride, sizeof(VI));
+            values = __builtin_convertvector((frames << 16) >> 16, V);
+        } else {
+            VS packed;
+            if constexpr (channels == 1 && !packed24) {
+                std::memcpy(&packed, src + i * stride, sizeof(VS));
+            } else if constexpr (channels == 2 && !packed24) {
+                VF frames;
+                std::memcpy(&frames, src + i * stride, sizeof(VF));
+                VU low = __builtin_convertvector(frames, VU);
+                std::memcpy(&packed, &low, sizeof(VS));
+            } else {
+                for (size_t l = 0; l < lanes; ++l) {
+                    S lane;
+                    std::memcpy(&lane, src + (i + l) * stride, sizeof(S));
+                    packed[l] = lane;
+                }
+            }
+            if constexpr (packed24) {
+                packed = (packed << 8) >> 8;
+            }
+            if constexpr (sizeof(S) == 2) {
+                values = __builtin_convertvector(__builtin_convertvector(packed, VI), V);
+            } else {
+                values = __builtin_convertvector(packed, V);
+            }
+        }
+        values *= scale;
+        std::memcpy(dst + i, &values, sizeof(V));
+    }
+    return i;
+}
+
+template <typename T, typename Isa, typename Sample>
+void decodeLoop(const char* src, size_t stride, size_t count, T* dst) {
+    size_t i = 0;
+    if constexpr (Isa::bytes > sizeof(T) && vectorSample<Sample>()) {
+        if (stride == Sample::bytes) {
+            i = decodeVectors<T, Isa, Sample, 1>(src, count, dst);
+        } else if (stride == 2 * Sample::bytes) {
+            i = decodeVectors<T, Isa, Sample, 2>(src, count, dst);
+        }
+    }
+    for (; i < count; ++i) {
+        dst[i] = decodeValue<Sample, T>(loadSample<Sample>(src + i * stride));
+    }
+}
+
+/* the inverse of decodeVectors; lanes that are not dense are stored one by
+ * one, a 24-bit lane as its three bytes, so no other channel is touched,
+ * and 16-bit lanes are narrowed from 32-bit ones */
+template <typename T, typename Isa, typename Sample, size_t channels>
+size_t encodeVectors(const T* src, const T* dither, size_t count, char* dst, T lo, T hi) {
+    typedef typename Sample::Storage S;
+    constexpr size_t lanes = Isa::bytes / sizeof(T);
+    constexpr size_t stride = channels * Sample::bytes;
+    typedef T V __attribute__((vector_size(Isa::bytes)));
+    typedef S VS __attribute__((vector_size(lanes * sizeof(S))));
+    const V scale = V{} + T(Sample::full_scale);
+    const V zero = V{};
+    const V half = V{} + T(0.5);
+    const V v_lo = V{} + lo;
+    const V v_hi = V{} + hi;
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        V v;
+        std::memcpy(&v, src + i, sizeof(V));
+        if constexpr (Sample::integral) {
+            v = v * scale;
+            if (dither) {
+                V d;
+                std::memcpy(&d, dither + i, sizeof(V));
+                v = v + d;
+            }
+            v = v < zero ? v - half : v + half;
+            v = v < v_lo ? v_lo : v;
+            v = v > v_hi ? v_hi : v;
+        }
+        VS packed;
+        if constexpr (sizeof(S) == 2) {
+            typedef int32_t VI __attribute__((vector_size(lanes * sizeof(int32_t))));
+            packed = __builtin_convertvector(__builtin_convertvector(v, VI), VS);
+        } else {
+            packed = __builtin_convertvector(v, VS);
+        }
+        if constexpr (channels == 1 && Sample::bytes == sizeof(S)) {
+            std::memcpy(dst + i * stride, &packed, sizeof(VS));
+        } else {
+            for (size_t l = 0; l < lanes; ++l) {
+                storeSample<Sample>(dst + (i + l) * stride, packed[l]);
+            }
+        }
+    }
+    return i;
+}
+
+template <typename T, typename Isa, typename Sample>
+void encodeLoop(const T* src, const T* dither, size_t count, char* dst, size_t stride) {
+    const T lo = sampleLimit<T>(Sample::min);
+    const T hi = sampleLimit<T>(Sample::max);
+    size_t i = 0;
+    if constexpr (Isa::bytes > sizeof(T) && vectorSample<Sample>()) {
+        if (stride == Sample::bytes) {
+            i = encodeVectors<T, Isa, Sample, 1>(src, dither, count, dst, lo, hi);
+        } else if (stride == 2 * Sample::bytes) {
+            i = encodeVectors<T, Isa, Sample, 2>(src, dither, count, dst, lo, hi);
+        }
+    }
+    for (; i < count; ++i) {
+        storeSample<Sample>(dst + i * stride, encodeValue<Sample>(src[i], dither ? dither[i] : T(0), lo, hi));
+    }
+}
+
+/* the table is indexed by SampleFormat */
+template <typename T, typename Isa>
+PcmKernels<T> makePcmKernels(const char* name) {
+    return {
+        name,
+        {
+            decodeLoop<T, Isa, UInt8Sample>,
+            decodeLoop<T, Isa, Int16Sample>,
+            decodeLoop<T, Isa, Int24Sample>,
+            decodeLoop<T, Isa, Int32Sample>,
+            decodeLoop<T, Isa, Float32Sample>
+        },
+        {
+            encodeLoop<T, Isa, UInt8Sample>,
+            encodeLoop<T, Isa, Int16Sample>,
+            encodeLoop<T, Isa, Int24Sample>,
+            encodeLoop<T, Isa, Int32Sample>,
+            encodeLoop<T, Isa, Float32Sample>
+        }
+    };
+}
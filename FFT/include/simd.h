@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+/* Instruction set tags. Each kernel instantiation is tied to its own tag,
+ * so code built with different -m flags never gets merged by the linker. */
+struct ScalarIsa { static constexpr size_t bytes = 0; };
+struct Sse2Isa { static constexpr size_t bytes = 16; };
+struct Avx2Isa { static constexpr size_t bytes = 32; };
+struct Avx512Isa { static constexpr size_t bytes = 64; };
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/* Per-stage time and sample counters behind --stats. Every stage counts
+ * the input samples it moved forward, one channel's samples per value, so
+ * the rates of all stages are in the same unit whatever the PCM format,
+ * precision, padding or frame overlap. Collection is off by default: a
+ * ScopedTimer then costs one relaxed load and takes no clock readings.
+ * Stages running on several threads add up their time, so the sum may
+ * exceed the wall time. */
+enum Stage {
+    /* header parsing and mapping of the source */
+    STAGE_OPEN,
+    /* interleaved PCM to planar samples */
+    STAGE_DECODE,
+    STAGE_FILTER,
+    STAGE_FORWARD,
+    /* choosing the kept bins */
+    STAGE_SELECT,
+    STAGE_INVERSE,
+    /* planar samples back to PCM in the result */
+    STAGE_ENCODE,
+    /* sizing and mapping of the result */
+    STAGE_CREATE,
+    STAGE_COUNT
+};
+
+void setStatsEnabled(bool enabled);
+
+inline std::atomic<bool>& statsEnabledFlag() {
+    static std::atomic<bool> enabled(false);
+    return enabled;
+}
+
+inline bool statsEnabled() {
+    return statsEnabledFlag().load(std::memory_order_relaxed);
+}
+
+/* adds to the counters of a stage */
+void addStageTime(Stage stage, uint64_t nanoseconds, uint64_t samples);
+
+/* Times its own scope; samples are the input samples the stage processed. */
+class ScopedTimer {
+public:
+
+    explicit ScopedTimer(Stage stage, uint64_t samples = 0)
+        : stage_(stage), samples_(samples), active_(statsEnabled()) {
+        if (active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (active_) {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            addStageTime(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), samples_);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    /* for stages that learn their size on the way */
+    void setSamples(uint64_t samples) {
+        samples_ = samples;
+    }
+
+private:
+
+    Stage stage_;
+    uint64_t samples_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+
+};
+
+/* calls, seconds, millions of samples and their rate for every stage that
+ * ran, the wall time and the peak RSS of the process; a table or one JSON
+ * object */
+void printStats(std::ostream& out, bool json, double wall_seconds);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include "fft.h"
+
+/* Streaming version of commpressData with bounded memory. The signal is cut
+ * into frames of frame_size samples with a hop of frame_size / 2, every frame
+ * is windowed with a periodic sqrt-Hann window, all but the largest
+ * `percents` percent of its bins are zeroed like in commpressData, and the
+ * frames are windowed again and overlap-added.
+ * The squared window sums to one at this hop, so an untouched spectrum gives
+ * back the input exactly. Memory use depends only on frame_size. */
+template <typename T = double>
+class StftCompressor {
+public:
+
+    explicit StftCompressor(size_t frame_size, char percents = 20);
+
+    /* frames of plan->size() samples; one plan can be shared by the
+     * compressors of all channels, each of them may run on its own thread */
+    explicit StftCompressor(std::shared_ptr<const RealFftPlan<T>> plan, char percents = 20);
+
+    size_t frameSize() const;
+
+    /* appends every sample that is already final to out,
+     * the output runs frame_size / 2 samples behind the input */
+    void push(const T* samples, size_t count, std::vector<T>& out);
+
+    /* flushes the remaining samples, after that exactly as many samples
+     * were produced as were pushed */
+    void finish(std::vector<T>& out);
+
+private:
+
+    void processFrame(std::vector<T>& out);
+
+    size_t frame_size_;
+    size_t hop_;
+    char percents_;
+    std::shared_ptr<const RealFftPlan<T>> plan_;
+    std::vector<T> window_;
+    /* the last frame_size input samples, filled_ of them valid */
+    std::vector<T> input_;
+    size_t filled_;
+    /* second half of the previous frame waiting for the next one */
+    std::vector<T> overlap_;
+    /* frame_size + 2 values, the spectrum is computed in place */
+    std::vector<T> frame_;
+    /* the first hop of output covers the zero padding before the signal */
+    size_t skip_;
+    size_t pushed_;
+    size_t produced_;
+    /* input samples reported to the stage counters, the flush frames of
+     * finish() only add what is left of pushed_ */
+    size_t counted_;
+
+};
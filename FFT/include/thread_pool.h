@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* Fixed set of worker threads. The thread that waits for a parallelFor
+ * executes queued work itself, so nested calls from inside a task
+ * cannot deadlock the pool. */
+class ThreadPool {
+public:
+
+    explicit ThreadPool(size_t threads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /* number of threads taking part in the work, the caller included */
+    size_t size() const;
+
+    /* calls body(begin, end) on disjoint chunks covering [0, count)
+     * and returns when all of them are finished */
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& body);
+
+private:
+
+    void workerLoop();
+
+    bool runOneTask(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    /* signalled on new tasks and on finished parallelFor calls */
+    std::condition_variable wake_;
+    bool stopping_;
+
+};
+
+/* Queue between two pipeline stages. push blocks while the queue is full,
+ * so a fast producer cannot run ahead of its consumer by more than
+ * capacity items; pop blocks until an item arrives or the queue is closed. */
+template <typename T>
+class BoundedQueue {
+public:
+
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+        items_.push(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    /* false when the queue is closed and drained */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /* no more pushes, waiting consumers drain what is left */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+
+    size_t capacity_;
+    bool closed_;
+    std::queue<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+
+};
@@ -1,8 +1,13 @@
+#pragma once
+
 #include <cassert>
 #include <cmath>
 #include <complex>
+#include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iostream>
+#include <string>
 #include <vector>
 
 // Структура, описывающая заголовок WAV файла.
@@ -69,8 +74,156 @@ struct WAVHEADER {
     // Далее следуют непосредственно Wav данные.
 };
 
-void getWavHeader(FILE* file, WAVHEADER* header);
+// Форматы сэмплов, которые умеют читать decodeChannels и писать encodeChannels.
+// Значения используются как индексы в таблицах PcmKernels.
+enum SampleFormat {
+    SAMPLE_UINT8,
+    SAMPLE_INT16,
+    SAMPLE_INT24,
+    SAMPLE_INT32,
+    SAMPLE_FLOAT32,
+    SAMPLE_FORMAT_COUNT,
+    SAMPLE_UNSUPPORTED = SAMPLE_FORMAT_COUNT
+};
+
+// Подцепочка RIFF: идентификатор, размер содержимого и его смещение от начала файла.
+struct RiffChunk {
+    char id[4];
+    uint64_t size;
+    uint64_t offset;
+};
+
+// Читает size байт со смещения offset, false если файл короче.
+typedef std::function<bool(uint64_t offset, void* buffer, size_t size)> RiffReader;
+
+// Обход подцепочек RIFF или RF64 файла. Читаются только 8-байтные заголовки,
+// содержимое неизвестных подцепочек пропускается без чтения. В RF64 размер
+// "data" не помещается в 32 бита и берётся из подцепочки ds64.
+class RiffChunkIterator {
+public:
+
+    RiffChunkIterator(RiffReader reader, uint64_t file_size);
+
+    // false, если файл не RIFF/RF64 WAVE.
+    bool valid() const;
+
+    // Следующая подцепочка, false в конце файла.
+    bool next(RiffChunk& chunk);
+
+private:
+
+    RiffReader reader_;
+    uint64_t file_size_;
+    uint64_t position_;
+    bool valid_;
+    bool rf64_;
+    uint64_t data_size64_;
+
+};
+
+// Находит "fmt " и "data" среди остальных подцепочек. Формат, в том числе
+// WAVE_FORMAT_EXTENSIBLE, приводится к каноническому заголовку (audioFormat 1 или 3),
+// subchunk2Size ограничивается 32 битами, полный размер данных лежит в data->size.
+// Файл без каналов или с blockAlign, не равным numChannels * байты сэмпла, отвергается.
+bool readWavLayout(const RiffReader& reader, uint64_t file_size, WAVHEADER* header, RiffChunk* data);
+
+// Читает заголовок и оставляет файл на начале области данных.
+bool getWavHeader(FILE* file, WAVHEADER* header, uint64_t* data_size = nullptr);
 
 void printWavData(WAVHEADER* header);
 
 void saveNewWav(std::string result, WAVHEADER* header, std::vector<std::complex<double>>& data);
+
+// Формат сэмплов по audioFormat и bitsPerSample.
+SampleFormat sampleFormat(const WAVHEADER* header);
+
+// Разбирает frames кадров чередующихся каналов: decodeChannel один канал channel
+// в samples, decodeChannels каждый канал в отдельный буфер. Значения приводятся
+// к диапазону [-1, 1).
+template <typename T>
+void decodeChannel(const char* data, size_t frames, const WAVHEADER* header, size_t channel, T* samples);
+
+template <typename T>
+void decodeChannels(const char* data, size_t frames, const WAVHEADER* header, std::vector<std::vector<T>>& channels);
+
+// Обратное преобразование с округлением и насыщением, encodeChannel пишет только
+// сэмплы канала channel. С dither перед округлением добавляется треугольный шум
+// амплитудой в один младший разряд.
+template <typename T>
+void encodeChannel(const T* samples, size_t frames, const WAVHEADER* header, size_t channel, char* data, bool dither);
+
+template <typename T>
+void encodeChannels(const std::vector<std::vector<T>>& channels, const WAVHEADER* header, char* data, bool dither);
+
+template <typename T>
+void saveNewWav(std::string result, WAVHEADER* header, const std::vector<std::vector<T>>& channels, bool dither);
+
+// WAV файл, отображённый в память. Данные не копируются: samples() указывает
+// прямо в страницы файла, а при записи сэмплы кодируются сразу в выходной файл,
+// размер которого задаётся заранее. Ошибки печатаются через perror, методы
+// open и create возвращают false.
+class WavFile {
+public:
+
+    WavFile() = default;
+    ~WavFile();
+
+    WavFile(const WavFile&) = delete;
+    WavFile& operator=(const WavFile&) = delete;
+
+    // Открывает файл на чтение.
+    bool open(const std::string& path);
+
+    // Создаёт файл с форматом из header и областью данных data_size байт.
+    // Если размер не помещается в 32 бита, файл пишется как RF64.
+    bool create(const std::string& path, const WAVHEADER& header, size_t data_size);
+
+    // Снимает отображение, записанные данные остаются в файле.
+    void close();
+
+    const WAVHEADER& header() const;
+
+    // Количество кадров, то есть сэмплов одного канала.
+    size_t frames() const;
+
+    char* data();
+    const char* data() const;
+    size_t dataSize() const;
+
+    // Типизированный вид области данных, S должен совпадать с форматом сэмплов.
+    // Чередование каналов сохраняется: кадр i канала c лежит в samples<S>()[i * numChannels + c].
+    template <typename S>
+    const S* samples() const {
+        return reinterpret_cast<const S*>(data());
+    }
+
+    template <typename S>
+    S* samples() {
+        return reinterpret_cast<S*>(data());
+    }
+
+    // Просит ядро заранее прочитать область данных, пока занят другой файл.
+    void prefetch();
+
+    // Первые end байт области данных больше не нужны: при последовательной
+    // обработке это не даёт файлу целиком осесть в памяти.
+    void release(size_t end);
+
+    // Отпускает все страницы, но не навсегда, как release: следующее обращение
+    // снова найдёт данные в кэше файловой системы. Так файл не накапливается
+    // в памяти процесса, когда его приходится проходить несколько раз.
+    void evict();
+
+private:
+
+    bool map(int fd, size_t size, bool writable);
+
+    WAVHEADER header_ = {};
+    char* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    size_t data_offset_ = 0;
+    size_t data_size_ = 0;
+    // граница уже отпущенных страниц от начала отображения
+    size_t released_ = 0;
+
+};
@@ -1,57 +1,447 @@
+#include <algorithm>
+#include <chrono>
 #include <cassert>
 #include <cmath>
 #include <complex>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "batch.h"
+#include "codec.h"
 #include "fft.h"
+#include "fir.h"
+#include "stats.h"
+#include "stft.h"
+#include "thread_pool.h"
 #include "wav.h"
 
-int main(int argc, char** argv) {
+const char* USAGE =
+    "vhWawCompressor [--tune] [--stats[=json]] [--threads N] [--precision float|double] [--stream FRAME] [--percents P] [--dither]\n"
+    "                [--filter SPEC|taps.txt] [--filter-taps N] [--decimate K] source.waw result.waw\n"
+    "vhWawCompressor compress [--stream FRAME] [--percents P] [--bits B] source.waw result.vhwc\n"
+    "vhWawCompressor decompress [--dither] source.vhwc result.waw\n"
+    "vhWawCompressor batch [--workers N] [--percents P] [--dither] source_dir|manifest result_dir";
 
-    if (argc != 3) {
-       std::cout << "WRONG ARGUMENTS, try: vhWawCompressor source.waw result.waw" << std::endl;
-       return 0;
+/* whole-file mode compresses channels side by side only while their
+ * buffers together take at most this much */
+const size_t CHANNEL_MEMORY_BUDGET = size_t(512) << 20;
+
+/* bytes read from the source per step in streaming mode */
+const size_t STREAM_CHUNK_SIZE = 1 << 16;
+
+struct Options {
+    /* empty for WAV to WAV, "compress" or "decompress" for the container,
+     * "batch" for a directory or a manifest */
+    std::string mode;
+    std::string source;
+    std::string result;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    /* compress stage threads of the batch pipeline */
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    bool single_precision = false;
+    /* frame size of the streaming compressor, 0 means whole file at once */
+    size_t stream_frame = 0;
+    /* TPDF dither before requantizing to integer samples */
+    bool dither = false;
+    /* quantizer resolution of the container */
+    int bits = 16;
+    /* share of spectrum bins kept in every frame */
+    char percents = 20;
+    /* FIR stage before compression: a response spec or a file of taps */
+    std::string filter;
+    size_t filter_taps = 511;
+    /* the result is written at 1/decimate of the sample rate */
+    size_t decimate = 1;
+    /* per-stage report on stderr after the run */
+    bool stats = false;
+    bool stats_json = false;
+    /* time the FFT variants of new sizes and save the winners as wisdom */
+    bool tune = false;
+};
+
+bool parseArguments(int argc, char** argv, Options& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--threads" && i + 1 < argc) {
+            int threads = std::atoi(argv[++i]);
+            if (threads <= 0) {
+                return false;
+            }
+            options.threads = threads;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            int workers = std::atoi(argv[++i]);
+            if (workers <= 0) {
+                return false;
+            }
+            options.workers = workers;
+        } else if (arg == "--precision" && i + 1 < argc) {
+            std::string precision(argv[++i]);
+            if (precision != "float" && precision != "double") {
+                return false;
+            }
+            options.single_precision = precision == "float";
+        } else if (arg == "--stream" && i + 1 < argc) {
+            int frame = std::atoi(argv[++i]);
+            if (frame < 2 || frame % 2 != 0) {
+                return false;
+            }
+            options.stream_frame = frame;
+        } else if (arg == "--bits" && i + 1 < argc) {
+            int bits = std::atoi(argv[++i]);
+            if (bits < 1 || bits > 24) {
+                return false;
+            }
+            options.bits = bits;
+        } else if (arg == "--percents" && i + 1 < argc) {
+            int percents = std::atoi(argv[++i]);
+            if (percents < 1 || percents > 100) {
+                return false;
+            }
+            options.percents = percents;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--filter-taps" && i + 1 < argc) {
+            int taps = std::atoi(argv[++i]);
+            if (taps <= 0) {
+                return false;
+            }
+            options.filter_taps = taps;
+        } else if (arg == "--decimate" && i + 1 < argc) {
+            int decimate = std::atoi(argv[++i]);
+            if (decimate < 2) {
+                return false;
+            }
+            options.decimate = decimate;
+        } else if (arg == "--dither") {
+            options.dither = true;
+        } else if (arg == "--stats" || arg == "--stats=table" || arg == "--stats=json") {
+            options.stats = true;
+            options.stats_json = arg == "--stats=json";
+        } else if (arg == "--tune") {
+            options.tune = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() == 3) {
+        options.mode = positional[0];
+        positional.erase(positional.begin());
+        if (options.mode != "compress" && options.mode != "decompress" && options.mode != "batch") {
+            return false;
+        }
+        /* the MDCT hop has to be even */
+        if (options.stream_frame % 4 != 0) {
+            return false;
+        }
+        /* batch jobs always compress the whole file, unfiltered */
+        if (options.mode == "batch" && (!options.filter.empty() || options.stream_frame > 0)) {
+            return false;
+        }
+    }
+    if (positional.size() != 2) {
+        return false;
+    }
+    /* decimation works on the whole spectrum of the file */
+    if (options.decimate > 1 && (!options.mode.empty() || options.stream_frame > 0)) {
+        return false;
+    }
+    options.source = positional[0];
+    options.result = positional[1];
+    return true;
+}
+
+/* the response of --filter, null without it; false if the spec is bad */
+template <typename T>
+bool makeFilter(const Options& options, double sample_rate, std::shared_ptr<const FirResponse<T>>& filter) {
+    if (options.filter.empty()) {
+        return true;
+    }
+    FrequencyResponse response;
+    std::vector<T> taps;
+    if (parseFrequencyResponse(options.filter, response)) {
+        taps = designFir<T>(response, sample_rate, options.filter_taps);
+    } else {
+        std::vector<double> values;
+        if (!readFirTaps(options.filter, values)) {
+            return false;
+        }
+        taps.assign(values.begin(), values.end());
+    }
+    filter = std::make_shared<const FirResponse<T>>(taps);
+    return true;
+}
+
+/* T is the scalar type of the whole transform, float halves the memory
+ * traffic and doubles the SIMD width at a small cost in SNR */
+template <typename T>
+void compressSamples(WavFile& source, const Options& options) {
+    /* Channels are independent and share one plan. They run side by side
+     * on the FFT pool, as many at a time as there are threads and as their
+     * buffers fit in CHANNEL_MEMORY_BUDGET, so long files go one channel at a
+     * time and the peak stays bounded; large transforms use the pool
+     * themselves. Samples are decoded straight from the mapped file, the
+     * real-input transform keeps the spectrum in the same buffer (two extra
+     * values), and the result is encoded straight into the mapped result in
+     * channel order. Pages of both files are let go after every group. */
+    const WAVHEADER& header = source.header();
+    size_t frames = source.frames();
+
+    std::shared_ptr<const FirResponse<T>> filter;
+    if (!makeFilter(options, header.sampleRate, filter)) {
+        return;
+    }
+
+    /* with decimation the result is ceil(frames / k) samples at 1/k of the rate */
+    WAVHEADER result_header = header;
+    size_t result_frames = frames;
+    if (options.decimate > 1) {
+        if (header.sampleRate % options.decimate != 0) {
+            std::cout << "Sample rate " << header.sampleRate << " is not divisible by "
+                      << options.decimate << "." << std::endl;
+            return;
+        }
+        result_header.sampleRate = header.sampleRate / options.decimate;
+        result_header.byteRate = result_header.sampleRate * header.blockAlign;
+        result_frames = (frames + options.decimate - 1) / options.decimate;
+    }
+
+    WavFile target;
+    if (!target.create(options.result, result_header, result_frames * header.blockAlign)) {
+        return;
+    }
+    if (frames == 0) {
+        return;
+    }
+
+    /* a length that would need the Bluestein convolution is zero-padded to
+     * the nearest fast one, decimation pads to a multiple of k whose k-th
+     * part is fast */
+    std::unique_ptr<RealFftPlan<T>> reduced;
+    if (options.decimate > 1) {
+        reduced = std::make_unique<RealFftPlan<T>>(decimationFftSize(frames, options.decimate));
+    }
+    RealFftPlan<T> plan(reduced ? reduced->size() * options.decimate : compressionFftSize(frames));
+
+    size_t channel_bytes = (plan.size() + 2) * sizeof(T) * (filter ? 2 : 1);
+    size_t group = std::max<size_t>(1, CHANNEL_MEMORY_BUDGET / channel_bytes);
+    group = std::min<size_t>({group, fftThreads(), header.numChannels});
+    std::vector<std::vector<T>> samples(group);
+    std::vector<std::vector<T>> filtered(filter ? group : 0);
+    for (size_t g = 0; g < group; ++g) {
+        samples[g].reserve(plan.size() + 2);
+        if (filter) {
+            filtered[g].reserve(plan.size() + 2);
+        }
+    }
+
+    for (size_t first = 0; first < header.numChannels; first += group) {
+        size_t count = std::min<size_t>(group, header.numChannels - first);
+        fftThreadPool().parallelFor(count, [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; ++g) {
+                std::vector<T>& channel = samples[g];
+                channel.resize(frames);
+                decodeChannel(source.data(), frames, &header, first + g, channel.data());
+                if (filter) {
+                    filtered[g].clear();
+                    OverlapSaveFilter<T> stage(filter);
+                    stage.push(channel.data(), frames, filtered[g]);
+                    stage.finish(filtered[g]);
+                    channel.swap(filtered[g]);
+                }
+                if (reduced) {
+                    decimateData(channel, plan, *reduced, options.percents);
+                } else {
+                    commpressData(channel, plan, options.percents);
+                }
+            }
+        });
+        source.evict();
+        for (size_t g = 0; g < count; ++g) {
+            encodeChannel(samples[g].data(), samples[g].size(), &target.header(), first + g, target.data(),
+                          options.dither);
+        }
+        target.evict();
     }
+}
+
+/* frame by frame compression, memory does not depend on the file length:
+ * both files are mapped and the pages behind the current position are released */
+template <typename T>
+void compressStream(WavFile& source, const Options& options) {
+    const WAVHEADER& header = source.header();
+    size_t block = header.blockAlign;
+    std::shared_ptr<const FirResponse<T>> filter;
+    if (!makeFilter(options, header.sampleRate, filter)) {
+        return;
+    }
+    WavFile target;
+    if (!target.create(options.result, header, source.frames() * block)) {
+        return;
+    }
+
+    auto plan = std::make_shared<const RealFftPlan<T>>(options.stream_frame);
+    std::vector<StftCompressor<T>> compressors;
+    std::vector<OverlapSaveFilter<T>> filters;
+    compressors.reserve(header.numChannels);
+    for (size_t c = 0; c < header.numChannels; ++c) {
+        compressors.emplace_back(plan, options.percents);
+        if (filter) {
+            filters.emplace_back(filter);
+        }
+    }
+    /* whole frames only, so no sample is split between two steps */
+    size_t chunk_frames = std::max<size_t>(1, STREAM_CHUNK_SIZE / block);
+    std::vector<std::vector<T>> samples;
+    std::vector<std::vector<T>> compressed(header.numChannels);
+    std::vector<std::vector<T>> filtered(header.numChannels);
+
+    size_t written = 0;
+    auto flush = [&]() {
+        encodeChannels(compressed, &header, target.data() + written * block, options.dither);
+        written += compressed.empty() ? 0 : compressed[0].size();
+        target.release(written * block);
+    };
 
-    std::string source(argv[1]);
-    std::string result(argv[2]);
+    for (size_t read = 0; read < source.frames(); read += chunk_frames) {
+        size_t frames = std::min(chunk_frames, source.frames() - read);
+        decodeChannels(source.data() + read * block, frames, &header, samples);
+        source.release((read + frames) * block);
+        fftThreadPool().parallelFor(compressors.size(), [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                compressed[c].clear();
+                if (filter) {
+                    filtered[c].clear();
+                    filters[c].push(samples[c].data(), frames, filtered[c]);
+                    compressors[c].push(filtered[c].data(), filtered[c].size(), compressed[c]);
+                } else {
+                    compressors[c].push(samples[c].data(), frames, compressed[c]);
+                }
+            }
+        });
+        flush();
+    }
 
-    FILE *file = fopen(source.c_str(), "rb");
-    if (!file) {
-        perror("Failed open file");
-        return 0;
+    for (size_t c = 0; c < compressors.size(); ++c) {
+        compressed[c].clear();
+        if (filter) {
+            filtered[c].clear();
+            filters[c].finish(filtered[c]);
+            compressors[c].push(filtered[c].data(), filtered[c].size(), compressed[c]);
+        }
+        compressors[c].finish(compressed[c]);
     }
+    flush();
+}
 
-    WAVHEADER header;
+void run(const Options& options) {
+    std::string source(options.source);
+    std::string result(options.result);
+
+    if (options.mode == "batch") {
+        std::vector<std::string> sources;
+        if (!listBatchSources(source, sources)) {
+            return;
+        }
+        BatchOptions batch;
+        batch.workers = options.workers;
+        batch.percents = options.percents;
+        batch.dither = options.dither;
+        size_t failures = options.single_precision ? runBatch<float>(sources, result, batch)
+                                                   : runBatch<double>(sources, result, batch);
+        std::cout << sources.size() - failures << " of " << sources.size() << " files compressed." << std::endl;
+        return;
+    }
 
-    getWavHeader(file, &header);
+    if (options.mode == "decompress") {
+        if (options.single_precision) {
+            decompressFile<float>(source, result, options.dither);
+        } else {
+            decompressFile<double>(source, result, options.dither);
+        }
+        return;
+    }
+
+    WavFile file;
+    if (!file.open(source)) {
+        return;
+    }
+
+    WAVHEADER header = file.header();
 
     printWavData(&header);
-    char *data = new char[header.subchunk2Size];
-    fread(data, header.subchunk2Size, 1, file);
+
+    if (sampleFormat(&header) == SAMPLE_UNSUPPORTED || header.blockAlign == 0) {
+        std::cout << "Unsupported sample format." << std::endl;
+        return;
+    }
+
+    if (options.mode == "compress") {
+        CodecOptions codec;
+        if (options.stream_frame > 0) {
+            codec.frame_size = options.stream_frame;
+        }
+        codec.bits = options.bits;
+        codec.percents = options.percents;
+        if (options.single_precision) {
+            compressFile<float>(file, result, codec);
+        } else {
+            compressFile<double>(file, result, codec);
+        }
+        return;
+    }
+
+    if (options.stream_frame > 0) {
+        if (options.single_precision) {
+            compressStream<float>(file, options);
+        } else {
+            compressStream<double>(file, options);
+        }
+        return;
+    }
 
     std::cout << "Data is successfully loaded." << std::endl;
 
-    std::vector<std::complex<double>> complex_data(header.subchunk2Size);
-    for (size_t i = 0; i < header.subchunk2Size; ++i) {
-        complex_data[i] = data[i];
+    if (options.single_precision) {
+        compressSamples<float>(file, options);
+    } else {
+        compressSamples<double>(file, options);
     }
+}
+
+int main(int argc, char** argv) {
 
-    size_t tmp = 1;
-    while (tmp < header.subchunk2Size) {
-        tmp <<= 1;
+    Options options;
+    if (!parseArguments(argc, argv, options)) {
+       std::cout << "WRONG ARGUMENTS, try: " << USAGE << std::endl;
+       return 0;
     }
 
-    complex_data.resize(tmp);
+    setFftThreads(options.threads);
 
-    commpressData(complex_data);
+    /* plans of every size already tuned on this host are built the tuned way */
+    std::string wisdom = defaultFftWisdomPath();
+    loadFftWisdom(wisdom);
+    setFftTuning(options.tune);
+    setStatsEnabled(options.stats);
 
-    saveNewWav(result, &header, complex_data);
+    auto start = std::chrono::steady_clock::now();
+    run(options);
+    if (options.stats) {
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+        printStats(std::cerr, options.stats_json, wall.count());
+    }
 
-    delete[] data;
-    fclose(file);
+    if (options.tune) {
+        saveFftWisdom(wisdom);
+    }
 
     return 0;
 }
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <system_error>
+#include <thread>
+
+#include "batch.h"
+#include "fft.h"
+#include "thread_pool.h"
+#include "wav.h"
+
+/* files waiting between two stages */
+const size_t BATCH_QUEUE_SIZE = 2;
+
+bool listBatchSources(const std::string& input, std::vector<std::string>& sources) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if (fs::is_directory(input, error)) {
+        for (fs::directory_iterator it(input, error), end; !error && it != end; it.increment(error)) {
+            std::string extension = it->path().extension().string();
+            if (it->is_regular_file(error) && (extension == ".wav" || extension == ".waw")) {
+                sources.push_back(it->path().string());
+            }
+        }
+        if (error) {
+            errno = error.value();
+            perror("Failed read directory");
+            return false;
+        }
+        std::sort(sources.begin(), sources.end());
+        return true;
+    }
+    std::ifstream manifest(input);
+    if (!manifest) {
+        perror("Failed open file");
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            sources.push_back(line);
+        }
+    }
+    return true;
+}
+
+/* one file on its way through the pipeline */
+template <typename T>
+struct BatchJob {
+    std::string source;
+    std::string result;
+    WavFile file;
+    WAVHEADER header;
+    size_t frames;
+    std::vector<std::vector<T>> channels;
+};
+
+template <typename T>
+size_t runBatch(const std::vector<std::string>& sources, const std::string& result_directory,
+                const BatchOptions& options) {
+    namespace fs = std::filesystem;
+    typedef std::unique_ptr<BatchJob<T>> Job;
+
+    std::error_code error;
+    fs::create_directories(result_directory, error);
+    if (error) {
+        errno = error.value();
+        perror("Failed create directory");
+        return sources.size();
+    }
+
+    /* WavFile has already reported the reason, only the name is added */
+    std::atomic<size_t> failures(0);
+    auto skip = [&](const std::string& path) {
+        fprintf(stderr, "Skipped %s\n", path.c_str());
+        ++failures;
+    };
+
+    BoundedQueue<Job> opened(BATCH_QUEUE_SIZE);
+    BoundedQueue<Job> decoded(BATCH_QUEUE_SIZE);
+    BoundedQueue<Job> compressed(BATCH_QUEUE_SIZE);
+
+    /* the mapping is prefetched here, so the page faults of the decoder
+     * are mostly served from the page cache */
+    std::thread reader([&]() {
+        /* results already given to earlier sources, resolved */
+        std::set<fs::path> results;
+        for (const std::string& path : sources) {
+            Job job(new BatchJob<T>());
+            job->source = path;
+            job->result = (fs::path(result_directory) / fs::path(path).filename()).string();
+            /* the result is created with O_TRUNC, it must never be the source
+             * itself or the result of an earlier source of the same name */
+            std::error_code same_error;
+            fs::path canonical_source = fs::weakly_canonical(path, same_error);
+            if (!same_error && canonical_source == fs::weakly_canonical(job->result, same_error) && !same_error) {
+                fprintf(stderr, "Result overwrites source %s\n", path.c_str());
+                skip(path);
+                continue;
+            }
+            fs::path canonical_result = fs::weakly_canonical(job->result, same_error);
+            if (!results.insert(same_error ? fs::path(job->result) : canonical_result).second) {
+                fprintf(stderr, "Result overwrites an earlier result %s\n", path.c_str());
+                skip(path);
+                continue;
+            }
+            if (!job->file.open(path)) {
+                skip(path);
+                continue;
+            }
+            job->header = job->file.header();
+            if (sampleFormat(&job->header) == SAMPLE_UNSUPPORTED || job->header.blockAlign == 0) {
+                errno = EINVAL;
+                perror("Unsupported sample format");
+                skip(path);
+                continue;
+            }
+            job->frames = job->file.frames();
+            job->file.prefetch();
+            opened.push(std::move(job));
+        }
+        opened.close();
+    });
+
+    /* room for the zero padding and two extra values per channel let the
+     * real transform work in place */
+    std::thread decoder([&]() {
+        Job job;
+        while (opened.pop(job)) {
+            job->channels.resize(job->header.numChannels);
+            for (auto& channel : job->channels) {
+                channel.reserve(compressionFftSize(job->frames) + 2);
+            }
+            decodeChannels(job->file.data(), job->frames, &job->header, job->channels);
+            job->file.close();
+            decoded.push(std::move(job));
+        }
+        decoded.close();
+    });
+
+    /* a worker keeps the plan of the last length it saw,
+     * files of one batch usually share it */
+    std::atomic<size_t> running(options.workers);
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < options.workers; ++w) {
+        workers.emplace_back([&]() {
+            std::unique_ptr<RealFftPlan<T>> plan;
+            Job job;
+            while (decoded.pop(job)) {
+                if (job->frames > 0) {
+                    size_t size = compressionFftSize(job->frames);
+                    if (!plan || plan->size() != size) {
+                        plan.reset(new RealFftPlan<T>(size));
+                    }
+                    for (auto& channel : job->channels) {
+                        commpressData(channel, *plan, options.percents);
+                    }
+                }
+                compressed.push(std::move(job));
+            }
+            if (--running == 0) {
+                compressed.close();
+            }
+        });
+    }
+
+    std::thread writer([&]() {
+        Job job;
+        while (compressed.pop(job)) {
+            WavFile target;
+            if (!target.create(job->result, job->header, job->frames * job->header.blockAlign)) {
+                skip(job->source);
+                continue;
+            }
+            encodeChannels(job->channels, &target.header(), target.data(), options.dither);
+            target.close();
+        }
+    });
+
+    reader.join();
+    decoder.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    writer.join();
+    return failures;
+}
+
+template size_t runBatch<float>(const std::vector<std::string>&, const std::string&, const BatchOptions&);
+template size_t runBatch<double>(const std::vector<std::string>&, const std::string&, const BatchOptions&);
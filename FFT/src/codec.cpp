@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#include "codec.h"
+#include "fft.h"
+#include "mdct.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+const char CODEC_MAGIC[4] = {'V', 'H', 'W', 'C'};
+const uint16_t CODEC_VERSION = 1;
+const size_t CODEC_HEADER_SIZE = 32;
+
+/* symbols 0..31 are bit lengths of |q|, then the end of a channel frame */
+const int SYMBOL_EOB = 32;
+const int SYMBOL_COUNT = 33;
+const int MAX_CODE_LENGTH = 15;
+/* code lengths are stored as nibbles */
+const size_t CODE_LENGTHS_SIZE = (SYMBOL_COUNT + 1) / 2;
+
+/* Bits are written from the most significant one, so canonical codes can
+ * be compared as integers while reading. */
+class BitWriter {
+public:
+
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out), acc_(0), count_(0) {}
+
+    /* bits <= 32 */
+    void write(uint64_t value, int bits) {
+        acc_ = (acc_ << bits) | (value & ((uint64_t(1) << bits) - 1));
+        count_ += bits;
+        while (count_ >= 8) {
+            count_ -= 8;
+            out_.push_back(static_cast<uint8_t>(acc_ >> count_));
+        }
+    }
+
+    void flush() {
+        if (count_ > 0) {
+            out_.push_back(static_cast<uint8_t>(acc_ << (8 - count_)));
+        }
+        count_ = 0;
+    }
+
+private:
+
+    std::vector<uint8_t>& out_;
+    uint64_t acc_;
+    int count_;
+
+};
+
+class BitReader {
+public:
+
+    BitReader(const uint8_t* data, size_t size) : data_(data), size_(size), position_(0), acc_(0), count_(0) {}
+
+    /* bits <= 32, past the end zeros are read and exhausted() turns true */
+    uint32_t read(int bits) {
+        while (count_ < bits) {
+            acc_ = (acc_ << 8) | (position_ < size_ ? data_[position_] : 0);
+            ++position_;
+            count_ += 8;
+        }
+        count_ -= bits;
+        return static_cast<uint32_t>((acc_ >> count_) & ((uint64_t(1) << bits) - 1));
+    }
+
+    bool exhausted() const {
+        return position_ > size_;
+    }
+
+private:
+
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+    uint64_t acc_;
+    int count_;
+
+};
+
+/* Huffman code lengths limited to MAX_CODE_LENGTH: when the tree gets too
+ * deep the counts are halved (keeping every used symbol) and it is rebuilt. */
+static void buildCodeLengths(std::vector<uint64_t> counts, uint8_t* lengths) {
+    std::fill(lengths, lengths + SYMBOL_COUNT, 0);
+    for (;;) {
+        typedef std::pair<uint64_t, int> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+        std::vector<int> parent(2 * SYMBOL_COUNT, -1);
+        for (int s = 0; s < SYMBOL_COUNT; ++s) {
+            if (counts[s] > 0) {
+                heap.push({counts[s], s});
+            }
+        }
+        if (heap.size() == 1) {
+            lengths[heap.top().second] = 1;
+            return;
+        }
+        int next = SYMBOL_COUNT;
+        while (heap.size() > 1) {
+            Node a = heap.top();
+            heap.pop();
+            Node b = heap.top();
+            heap.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            heap.push({a.first + b.first, next++});
+        }
+        int longest = 0;
+        for (int s = 0; s < SYMBOL_COUNT; ++s) {
+            int depth = 0;
+            for (int node = s; parent[node] >= 0; node = parent[node]) {
+                ++depth;
+            }
+            lengths[s] = counts[s] > 0 ? depth : 0;
+            longest = std::max(longest, depth);
+        }
+        if (longest <= MAX_CODE_LENGTH) {
+            return;
+        }
+        for (auto& count : counts) {
+            count = count > 0 ? (count + 1) / 2 : 0;
+        }
+    }
+}
+
+/* canonical codes: shorter first, equal lengths in symbol order */
+static void buildCodes(const uint8_t* lengths, uint32_t* codes) {
+    int counts[MAX_CODE_LENGTH + 1] = {};
+    for (int s = 0; s < SYMBOL_COUNT; ++s) {
+        ++counts[lengths[s]];
+    }
+    counts[0] = 0;
+    uint32_t next[MAX_CODE_LENGTH + 1] = {};
+    uint32_t code = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + counts[length - 1]) << 1;
+        next[length] = code;
+    }
+    for (int s = 0; s < SYMBOL_COUNT; ++s) {
+        codes[s] = lengths[s] ? next[lengths[s]]++ : 0;
+    }
+}
+
+class HuffmanDecoder {
+public:
+
+    explicit HuffmanDecoder(const uint8_t* lengths) {
+        std::fill(counts_, counts_ + MAX_CODE_LENGTH + 1, 0);
+        for (int s = 0; s < SYMBOL_COUNT; ++s) {
+            ++counts_[lengths[s]];
+        }
+        counts_[0] = 0;
+        size_t index = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+            for (int s = 0; s < SYMBOL_COUNT; ++s) {
+                if (lengths[s] == length) {
+                    symbols_[index++] = s;
+                }
+            }
+        }
+    }
+
+    /* -1 for a code that is not in the table */
+    int decode(BitReader& reader) const {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+            code |= reader.read(1);
+            int count = counts_[length];
+            if (code - first < count) {
+                return symbols_[index + code - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+private:
+
+    int counts_[MAX_CODE_LENGTH + 1];
+    int symbols_[SYMBOL_COUNT];
+
+};
+
+static int bitLength(uint32_t value) {
+    return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+/* quantized has frames * channels runs of width coefficients */
+static void writeBlock(FILE* file, const std::vector<int32_t>& quantized, size_t frames, size_t width) {
+    size_t runs = quantized.size() / width;
+    std::vector<size_t> ends(runs);
+    std::vector<uint64_t> counts(SYMBOL_COUNT, 0);
+    for (size_t r = 0; r < runs; ++r) {
+        const int32_t* run = quantized.data() + r * width;
+        size_t end = width;
+        while (end > 0 && run[end - 1] == 0) {
+            --end;
+        }
+        ends[r] = end;
+        for (size_t i = 0; i < end; ++i) {
+            ++counts[bitLength(std::abs(run[i]))];
+        }
+        ++counts[SYMBOL_EOB];
+    }
+
+    uint8_t lengths[SYMBOL_COUNT];
+    uint32_t codes[SYMBOL_COUNT];
+    buildCodeLengths(counts, lengths);
+    buildCodes(lengths, codes);
+
+    std::vector<uint8_t> payload;
+    for (size_t s = 0; s < CODE_LENGTHS_SIZE; ++s) {
+        uint8_t high = lengths[2 * s];
+        uint8_t low = 2 * s + 1 < SYMBOL_COUNT ? lengths[2 * s + 1] : 0;
+        payload.push_back(static_cast<uint8_t>(high << 4 | low));
+    }
+    BitWriter writer(payload);
+    for (size_t r = 0; r < runs; ++r) {
+        const int32_t* run = quantized.data() + r * width;
+        for (size_t i = 0; i < ends[r]; ++i) {
+            uint32_t magnitude = std::abs(run[i]);
+            int symbol = bitLength(magnitude);
+            writer.write(codes[symbol], lengths[symbol]);
+            if (symbol > 0) {
+                writer.write(magnitude, symbol - 1);
+                writer.write(run[i] < 0, 1);
+            }
+        }
+        writer.write(codes[SYMBOL_EOB], lengths[SYMBOL_EOB]);
+    }
+    writer.flush();
+
+    uint32_t size = sizeof(uint32_t) + payload.size();
+    uint32_t block_frames = frames;
+    fwrite(&size, sizeof(size), 1, file);
+    fwrite(&block_frames, sizeof(block_frames), 1, file);
+    fwrite(payload.data(), 1, payload.size(), file);
+}
+
+template <typename T>
+static int32_t quantize(T value, T step) {
+    /* far above any real coefficient, keeps the symbol below 32 */
+    const T limit = T(1 << 30);
+    T q = std::round(value / step);
+    q = std::min(std::max(q, -limit), limit);
+    return static_cast<int32_t>(q);
+}
+
+template <typename T>
+bool compressFile(WavFile& source, const std::string& result, const CodecOptions& options) {
+    const WAVHEADER& header = source.header();
+    size_t channels = header.numChannels;
+    size_t block = header.blockAlign;
+    size_t length = source.frames();
+    uint32_t hop = options.frame_size / 2;
+    float step = std::ldexp(1.0f, 1 - options.bits);
+
+    FILE* file = fopen(result.c_str(), "wb");
+    if (!file) {
+        perror("Failed open file");
+        return false;
+    }
+
+    std::vector<char> layout;
+    auto put = [&layout](const void* bytes, size_t count) {
+        const char* p = static_cast<const char*>(bytes);
+        layout.insert(layout.end(), p, p + count);
+    };
+    uint64_t frames = length;
+    put(CODEC_MAGIC, 4);
+    put(&CODEC_VERSION, 2);
+    put(&header.audioFormat, 2);
+    put(&header.numChannels, 2);
+    put(&header.bitsPerSample, 2);
+    put(&header.sampleRate, 4);
+    put(&frames, 8);
+    put(&hop, 4);
+    put(&step, 4);
+    fwrite(layout.data(), 1, layout.size(), file);
+
+    std::vector<MdctPlan<T>> plans;
+    plans.reserve(channels);
+    for (size_t c = 0; c < channels; ++c) {
+        plans.emplace_back(hop);
+    }
+    /* the previous hop and the current one */
+    std::vector<std::vector<T>> windows(channels, std::vector<T>(2 * hop, T(0)));
+    std::vector<std::vector<T>> coefficients(channels, std::vector<T>(hop));
+    std::vector<std::vector<T>> current;
+    std::vector<int32_t> quantized;
+
+    /* frame f covers samples [(f - 1) hop, (f + 1) hop), the first and
+     * the last frames reach into the zero padding around the signal */
+    size_t total = (length + hop - 1) / hop + 1;
+    for (size_t block_start = 0; block_start < total; block_start += CODEC_BLOCK_FRAMES) {
+        size_t block_frames = std::min(CODEC_BLOCK_FRAMES, total - block_start);
+        size_t first = std::min<size_t>(block_start * hop, length);
+        size_t count = std::min<size_t>(block_frames * hop, length - first);
+        decodeChannels(source.data() + first * block, count, &header, current);
+        source.release((first + count) * block);
+
+        /* channels are independent, every task fills its own slots */
+        quantized.resize(block_frames * channels * hop);
+        fftThreadPool().parallelFor(channels, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                std::vector<T>& window = windows[c];
+                T* values = coefficients[c].data();
+                for (size_t f = 0; f < block_frames; ++f) {
+                    size_t offset = std::min(f * hop, count);
+                    size_t taken = std::min<size_t>(hop, count - offset);
+                    std::copy(window.begin() + hop, window.end(), window.begin());
+                    std::copy(current[c].begin() + offset, current[c].begin() + offset + taken, window.begin() + hop);
+                    std::fill(window.begin() + hop + taken, window.end(), T(0));
+                    /* frames overlap by a hop, each one counts the samples it
+                     * took in, not the padding */
+                    {
+                        ScopedTimer timer(STAGE_FORWARD, taken);
+                        plans[c].forward(window.data(), values);
+                    }
+                    {
+                        ScopedTimer timer(STAGE_SELECT, taken);
+                        keepLargest(values, hop, options.percents);
+                    }
+                    int32_t* out = quantized.data() + (f * channels + c) * hop;
+                    for (size_t k = 0; k < hop; ++k) {
+                        out[k] = quantize(values[k], T(step));
+                    }
+                }
+            }
+        });
+        writeBlock(file, quantized, block_frames, hop);
+    }
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        perror("Failed write file");
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool decompressFile(const std::string& source, const std::string& result, bool dither) {
+    FILE* file = fopen(source.c_str(), "rb");
+    if (!file) {
+        perror("Failed open file");
+        return false;
+    }
+    auto fail = [file](const char* message) {
+        /* a short or malformed file is not a system error */
+        if (!ferror(file)) {
+            errno = EINVAL;
+        }
+        perror(message);
+        fclose(file);
+        return false;
+    };
+
+    char layout[CODEC_HEADER_SIZE];
+    if (fread(layout, 1, sizeof(layout), file) != sizeof(layout) || std::memcmp(layout, CODEC_MAGIC, 4) != 0) {
+        return fail("Failed read container header");
+    }
+    const char* cursor = layout + 4;
+    auto get = [&cursor](void* value, size_t count) {
+        std::memcpy(value, cursor, count);
+        cursor += count;
+    };
+    uint16_t version;
+    uint64_t length;
+    uint32_t hop;
+    float step;
+    WAVHEADER header = {};
+    get(&version, 2);
+    get(&header.audioFormat, 2);
+    get(&header.numChannels, 2);
+    get(&header.bitsPerSample, 2);
+    get(&header.sampleRate, 4);
+    get(&length, 8);
+    get(&hop, 4);
+    get(&step, 4);
+    header.blockAlign = header.numChannels * header.bitsPerSample / 8;
+    header.byteRate = header.sampleRate * header.blockAlign;
+    if (version != CODEC_VERSION || sampleFormat(&header) == SAMPLE_UNSUPPORTED || header.numChannels == 0 ||
+        hop < 2 || hop % 2 != 0) {
+        return fail("Failed read container header");
+    }
+
+    size_t channels = header.numChannels;
+    size_t block = header.blockAlign;
+    WavFile target;
+    if (!target.create(result, header, length * block)) {
+        fclose(file);
+        return false;
+    }
+
+    std::vector<MdctPlan<T>> plans;
+    plans.reserve(channels);
+    for (size_t c = 0; c < channels; ++c) {
+        plans.emplace_back(hop);
+    }
+    std::vector<std::vector<T>> overlaps(channels, std::vector<T>(hop, T(0)));
+    std::vector<std::vector<T>> samples(channels, std::vector<T>(2 * hop));
+    std::vector<std::vector<T>> output(channels);
+    std::vector<T> values;
+    std::vector<uint8_t> payload;
+
+    size_t frame = 0;
+    size_t written = 0;
+    while (written < length) {
+        uint32_t size;
+        uint32_t frames;
+        if (fread(&size, sizeof(size), 1, file) != 1 || size < sizeof(frames) + CODE_LENGTHS_SIZE ||
+            fread(&frames, sizeof(frames), 1, file) != 1 || frames > CODEC_BLOCK_FRAMES) {
+            return fail("Failed read container block");
+        }
+        payload.resize(size - sizeof(frames));
+        if (fread(payload.data(), 1, payload.size(), file) != payload.size()) {
+            return fail("Failed read container block");
+        }
+
+        uint8_t lengths[SYMBOL_COUNT + 1];
+        for (size_t s = 0; s < CODE_LENGTHS_SIZE; ++s) {
+            lengths[2 * s] = payload[s] >> 4;
+            lengths[2 * s + 1] = payload[s] & 15;
+        }
+        HuffmanDecoder decoder(lengths);
+        BitReader reader(payload.data() + CODE_LENGTHS_SIZE, payload.size() - CODE_LENGTHS_SIZE);
+
+        /* the bit stream is sequential, the transforms run per channel */
+        values.assign(frames * channels * hop, T(0));
+        for (size_t run = 0; run < frames * channels; ++run) {
+            T* coefficients = values.data() + run * hop;
+            for (size_t k = 0;; ++k) {
+                int symbol = decoder.decode(reader);
+                if (symbol == SYMBOL_EOB) {
+                    break;
+                }
+                if (symbol < 0 || k >= hop || reader.exhausted()) {
+                    return fail("Failed decode container block");
+                }
+                if (symbol > 0) {
+                    uint32_t magnitude = (uint32_t(1) << (symbol - 1)) | reader.read(symbol - 1);
+                    T value = T(magnitude) * T(step);
+                    coefficients[k] = reader.read(1) ? -value : value;
+                }
+            }
+        }
+
+        /* frame 0 only fills the overlap, the others finish one hop each */
+        size_t skip = frame == 0 ? 1 : 0;
+        size_t count = std::min<uint64_t>((frames - std::min<size_t>(skip, frames)) * hop, length - written);
+        fftThreadPool().parallelFor(channels, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                std::vector<T>& overlap = overlaps[c];
+                output[c].resize(count);
+                for (size_t f = 0; f < frames; ++f) {
+                    /* every frame counts the samples it finishes */
+                    size_t offset = (f - std::min(f, skip)) * hop;
+                    size_t taken = f >= skip ? std::min<size_t>(hop, count - std::min(offset, count)) : 0;
+                    {
+                        ScopedTimer timer(STAGE_INVERSE, taken);
+                        plans[c].inverse(values.data() + (f * channels + c) * hop, samples[c].data());
+                    }
+                    for (size_t i = 0; i < taken; ++i) {
+                        output[c][offset + i] = overlap[i] + samples[c][i];
+                    }
+                    std::copy(samples[c].begin() + hop, samples[c].end(), overlap.begin());
+                }
+            }
+        });
+        frame += frames;
+        if (count > 0) {
+            encodeChannels(output, &target.header(), target.data() + written * block, dither);
+            written += count;
+            target.release(written * block);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+template bool compressFile<float>(WavFile& source, const std::string& result, const CodecOptions& options);
+template bool compressFile<double>(WavFile& source, const std::string& result, const CodecOptions& options);
+
+template bool decompressFile<float>(const std::string& source, const std::string& result, bool dither);
+template bool decompressFile<double>(const std::string& source, const std::string& result, bool dither);
@@ -1,61 +1,1391 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <complex>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
-std::vector<std::complex<double>> getHalfData(std::vector<std::complex<double>>& data, bool is_odd) {
-    std::vector<std::complex<double>> res;
-    for (size_t i = !is_odd; i < data.size(); i+= 2) {
-        res.push_back(data[i]);
+#include "fft.h"
+#include "fft_kernels.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+/* powers of two and mixed-radix sizes from this size on are split by the
+ * four-step algorithm, smaller ones fit in cache and run the plain stages */
+const size_t FOUR_STEP_MIN_SIZE = size_t(1) << 20;
+/* number of columns the four-step algorithm transforms together */
+const size_t FOUR_STEP_GROUP = 8;
+/* gathered columns are this many values apart more than their length,
+ * so they do not all fall into the same cache set */
+const size_t FOUR_STEP_PADDING = 8;
+/* real transforms keep exp(2*pi*i * k / n) for every k <= n / 4 up to this
+ * many values, longer ones keep two tables of about sqrt(n / 4) values
+ * whose products give the rest */
+const size_t REAL_TWIDDLE_TABLE_MAX = size_t(1) << 16;
+/* keepLargest selects among a copy of the magnitudes below this count and
+ * by counting passes over digits of this many bits from it on */
+const size_t SELECT_COPY_MAX = size_t(1) << 16;
+const int SELECT_DIGIT_BITS = 16;
+/* transposes work on square tiles of this side */
+const size_t TRANSPOSE_TILE = 16;
+/* smaller sizes are not tuned, four-step is tried from this size on */
+const size_t TUNE_MIN_SIZE = 64;
+const size_t TUNE_FOUR_STEP_MIN_SIZE = size_t(1) << 12;
+/* every candidate is timed at least this many times and this long */
+const int TUNE_MIN_RUNS = 3;
+const double TUNE_MIN_SECONDS = 0.02;
+const char* WISDOM_MAGIC = "vhWawCompressor-wisdom 1";
+
+template <>
+const FftKernels<float>& scalarFftKernels<float>() {
+    static const FftKernels<float> kernels = {
+        "scalar",
+        radix2Pass<float, ScalarIsa>,
+        radix4Pass<float, ScalarIsa>
+    };
+    return kernels;
+}
+
+template <>
+const FftKernels<double>& scalarFftKernels<double>() {
+    static const FftKernels<double> kernels = {
+        "scalar",
+        radix2Pass<double, ScalarIsa>,
+        radix4Pass<double, ScalarIsa>
+    };
+    return kernels;
+}
+
+/* every kernel set the CPU can run, the widest first */
+template <typename T>
+static std::vector<const FftKernels<T>*> detectAvailableKernels() {
+    std::vector<const FftKernels<T>*> available;
+#ifdef FFT_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        available.push_back(&avx512FftKernels<T>());
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        available.push_back(&avx2FftKernels<T>());
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        available.push_back(&sse2FftKernels<T>());
+    }
+#endif
+    available.push_back(&scalarFftKernels<T>());
+    return available;
+}
+
+template <typename T>
+static const std::vector<const FftKernels<T>*>& availableKernels() {
+    static const std::vector<const FftKernels<T>*> available = detectAvailableKernels<T>();
+    return available;
+}
+
+template <typename T>
+static const FftKernels<T>* findKernels(const char* name) {
+    for (auto kernels : availableKernels<T>()) {
+        if (std::strcmp(kernels->name, name) == 0) {
+            return kernels;
+        }
+    }
+    return nullptr;
+}
+
+static const char* forcedKernelName() {
+    return std::getenv("VH_FFT_KERNEL");
+}
+
+template <typename T>
+static const FftKernels<T>* detectKernels() {
+    const char* forced = forcedKernelName();
+    const FftKernels<T>* kernels = forced ? findKernels<T>(forced) : nullptr;
+    return kernels ? kernels : availableKernels<T>().front();
+}
+
+template <typename T>
+static const FftKernels<T>* defaultKernels() {
+    static const FftKernels<T>* kernels = detectKernels<T>();
+    return kernels;
+}
+
+/* Scratch buffers, one set per thread, so a single plan can be shared
+ * between threads. Every user gets its own slot since they can be active at
+ * the same time: the Bluestein convolution runs while the split slot still
+ * holds the outer data, and the real transform of odd size calls into the
+ * split interface of a mixed-radix plan. */
+enum WorkspaceSlot {
+    SPLIT_SLOT,
+    BLUESTEIN_SLOT,
+    REAL_SLOT,
+    COLUMN_SLOT,
+    SELECT_SLOT,
+    WORKSPACE_SLOTS
+};
+
+template <typename T>
+static T* workspace(WorkspaceSlot slot, size_t size) {
+    thread_local std::vector<T> buffers[WORKSPACE_SLOTS];
+    if (buffers[slot].size() < size) {
+        buffers[slot].resize(size);
+    }
+    return buffers[slot].data();
+}
+
+static std::unique_ptr<ThreadPool>& fftPool() {
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(1);
+    return pool;
+}
+
+void setFftThreads(size_t threads) {
+    fftPool() = std::make_unique<ThreadPool>(std::max<size_t>(threads, 1));
+}
+
+size_t fftThreads() {
+    return fftPool()->size();
+}
+
+ThreadPool& fftThreadPool() {
+    return *fftPool();
+}
+
+/* four-step plans tuned to stay on one thread use this pool, it has no workers */
+static ThreadPool& serialPool() {
+    static ThreadPool pool(1);
+    return pool;
+}
+
+/* Wisdom: the choice for every tuned size. The lock is recursive
+ * because tuning a size builds candidate plans that tune their own parts. */
+struct WisdomKey {
+    std::string precision;
+    size_t size;
+    size_t threads;
+
+    bool operator<(const WisdomKey& other) const {
+        return std::tie(precision, size, threads) < std::tie(other.precision, other.size, other.threads);
+    }
+};
+
+struct WisdomEntry {
+    std::string kernels;
+    std::string strategy;
+    bool parallel;
+};
+
+static std::recursive_mutex wisdomMutex;
+static std::map<WisdomKey, WisdomEntry> wisdom;
+static bool tuningEnabled = false;
+
+template <typename T>
+static const char* precisionName() {
+    return sizeof(T) == sizeof(float) ? "float" : "double";
+}
+
+void setFftTuning(bool enabled) {
+    std::lock_guard<std::recursive_mutex> lock(wisdomMutex);
+    tuningEnabled = enabled;
+}
+
+/* one entry per line: precision size threads kernels strategy parallel|serial */
+bool loadFftWisdom(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        if (errno != ENOENT) {
+            perror("Failed open wisdom");
+        }
+        return false;
+    }
+    std::string line;
+    if (!std::getline(in, line) || line != WISDOM_MAGIC) {
+        errno = EINVAL;
+        perror("Failed read wisdom");
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(wisdomMutex);
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        WisdomKey key;
+        WisdomEntry entry;
+        std::string mode;
+        if (fields >> key.precision >> key.size >> key.threads >> entry.kernels >> entry.strategy >> mode) {
+            entry.parallel = mode == "parallel";
+            wisdom[key] = entry;
+        }
+    }
+    return true;
+}
+
+bool saveFftWisdom(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    if (!directory.empty()) {
+        std::filesystem::create_directories(directory, error);
+    }
+    std::ofstream out(path);
+    if (!out) {
+        perror("Failed write wisdom");
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(wisdomMutex);
+    out << WISDOM_MAGIC << '\n';
+    for (const auto& item : wisdom) {
+        out << item.first.precision << ' ' << item.first.size << ' ' << item.first.threads << ' '
+            << item.second.kernels << ' ' << item.second.strategy << ' '
+            << (item.second.parallel ? "parallel" : "serial") << '\n';
+    }
+    if (!out) {
+        perror("Failed write wisdom");
+        return false;
+    }
+    return true;
+}
+
+std::string defaultFftWisdomPath() {
+    if (const char* path = std::getenv("VH_FFT_WISDOM")) {
+        return path;
+    }
+    std::string cache;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        cache = xdg;
+    } else if (const char* home = std::getenv("HOME")) {
+        cache = std::string(home) + "/.cache";
+    } else {
+        cache = ".cache";
+    }
+    return cache + "/vhWawCompressor/wisdom";
+}
+
+/* what is left of n after dividing out the factors 2, 3, 5 and 7 */
+static size_t roughPart(size_t n) {
+    for (size_t p : {2, 3, 5, 7}) {
+        while (n % p == 0) {
+            n /= p;
+        }
+    }
+    return n;
+}
+
+/* the largest product of the factors 2, 3, 5 and 7 whose square divides n */
+static size_t fourStepColumns(size_t n) {
+    size_t columns = 1;
+    for (size_t p : {2, 3, 5, 7}) {
+        while (n % (p * p) == 0) {
+            columns *= p;
+            n /= p * p;
+        }
+    }
+    return columns;
+}
+
+template <typename T>
+FftPlan<T>::FftPlan(size_t n) : FftPlan(n, choose(n)) {
+}
+
+template <typename T>
+FftPlan<T>::FftPlan(size_t n, const Choice& choice)
+    : n_(n), strategy_(choice.strategy), rows_(0), columns_(0), kernels_(choice.kernels), parallel_(choice.parallel) {
+    assert(n > 0 && usable(n, strategy_));
+
+    switch (strategy_) {
+        case Strategy::Radix2:
+            initRadix2();
+            break;
+        case Strategy::MixedRadix:
+            initMixedRadix();
+            break;
+        case Strategy::Bluestein:
+            initBluestein();
+            break;
+        case Strategy::FourStep:
+            initFourStep();
+            break;
+    }
+}
+
+/* wisdom names of the strategies, "radix" is the power of two one */
+template <typename T>
+const char* FftPlan<T>::strategyName(Strategy strategy) {
+    switch (strategy) {
+        case Strategy::Radix2:
+            return "radix";
+        case Strategy::MixedRadix:
+            return "mixed-radix";
+        case Strategy::Bluestein:
+            return "bluestein";
+        case Strategy::FourStep:
+            return "four-step";
     }
-    return res;
+    return "";
 }
 
-void fft(std::vector<std::complex<double>> &data, bool reversed) {
-    if (data.size() == 1) {
+/* Bluestein takes any size; four-step needs a square factor so that
+ * neither of its parts has the length of the whole */
+template <typename T>
+bool FftPlan<T>::usable(size_t n, Strategy strategy) {
+    switch (strategy) {
+        case Strategy::Radix2:
+            return (n & (n - 1)) == 0;
+        case Strategy::MixedRadix:
+            return roughPart(n) == 1;
+        case Strategy::Bluestein:
+            return true;
+        case Strategy::FourStep:
+            return roughPart(n) == 1 && fourStepColumns(n) > 1;
+    }
+    return false;
+}
+
+template <typename T>
+typename FftPlan<T>::Choice FftPlan<T>::choose(size_t n) {
+    Choice choice = {defaultKernels<T>(), Strategy::Bluestein, true};
+    if (roughPart(n) == 1) {
+        if (n >= FOUR_STEP_MIN_SIZE) {
+            choice.strategy = Strategy::FourStep;
+        } else if ((n & (n - 1)) == 0) {
+            choice.strategy = Strategy::Radix2;
+        } else {
+            choice.strategy = Strategy::MixedRadix;
+        }
+    }
+    if (n < TUNE_MIN_SIZE) {
+        return choice;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(wisdomMutex);
+    auto found = wisdom.find({precisionName<T>(), n, fftThreads()});
+    if (found != wisdom.end()) {
+        const WisdomEntry& entry = found->second;
+        const FftKernels<T>* kernels = findKernels<T>(entry.kernels.c_str());
+        if (kernels && !forcedKernelName()) {
+            choice.kernels = kernels;
+        }
+        for (Strategy strategy : {Strategy::Radix2, Strategy::MixedRadix, Strategy::Bluestein, Strategy::FourStep}) {
+            if (entry.strategy == strategyName(strategy) && usable(n, strategy)) {
+                choice.strategy = strategy;
+                choice.parallel = entry.parallel;
+            }
+        }
+        return choice;
+    }
+    if (!tuningEnabled) {
+        return choice;
+    }
+    choice = tune(n);
+    wisdom[{precisionName<T>(), n, fftThreads()}] = {
+        choice.kernels->name,
+        strategyName(choice.strategy),
+        choice.parallel
+    };
+    return choice;
+}
+
+/* Every candidate transforms the same random data in place, the best of
+ * several runs counts. Candidate four-step plans build their row and
+ * column plans through choose(), so those sizes are tuned first. */
+template <typename T>
+typename FftPlan<T>::Choice FftPlan<T>::tune(size_t n) {
+    std::vector<const FftKernels<T>*> kernels = availableKernels<T>();
+    if (forcedKernelName()) {
+        kernels.assign(1, defaultKernels<T>());
+    }
+    /* only the radix-2 stages run the kernels themselves */
+    std::vector<Choice> candidates;
+    if (usable(n, Strategy::Radix2)) {
+        for (auto k : kernels) {
+            candidates.push_back({k, Strategy::Radix2, true});
+        }
+    } else if (usable(n, Strategy::MixedRadix)) {
+        candidates.push_back({defaultKernels<T>(), Strategy::MixedRadix, true});
+    }
+    if (n >= TUNE_FOUR_STEP_MIN_SIZE && usable(n, Strategy::FourStep)) {
+        candidates.push_back({defaultKernels<T>(), Strategy::FourStep, true});
+        if (fftThreads() > 1) {
+            candidates.push_back({defaultKernels<T>(), Strategy::FourStep, false});
+        }
+    }
+    /* the chirp convolution runs on a power of two of twice the size, for
+     * mixed-radix sizes it is only worth a try while that fits in cache */
+    bool mixed = usable(n, Strategy::MixedRadix) && !usable(n, Strategy::Radix2);
+    if (candidates.empty() || (mixed && n < FOUR_STEP_MIN_SIZE / 2)) {
+        candidates.push_back({defaultKernels<T>(), Strategy::Bluestein, true});
+    }
+    if (candidates.size() == 1) {
+        return candidates.front();
+    }
+
+    std::vector<T> data(2 * n);
+    std::mt19937 random(n);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    for (T& x : data) {
+        x = value(random);
+    }
+
+    Choice best = candidates.front();
+    double best_seconds = 0;
+    for (const Choice& candidate : candidates) {
+        FftPlan<T> plan(n, candidate);
+        plan.transform(data.data(), data.data() + n, false);
+        double fastest = 0;
+        double total = 0;
+        for (int run = 0; run < TUNE_MIN_RUNS || total < TUNE_MIN_SECONDS; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            plan.transform(data.data(), data.data() + n, run % 2 == 1);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            total += elapsed.count();
+            fastest = run == 0 ? elapsed.count() : std::min(fastest, elapsed.count());
+        }
+        if (best_seconds == 0 || fastest < best_seconds) {
+            best = candidate;
+            best_seconds = fastest;
+        }
+    }
+    return best;
+}
+
+template <typename T>
+ThreadPool& FftPlan<T>::pool() const {
+    return parallel_ ? *fftPool() : serialPool();
+}
+
+template <typename T>
+void FftPlan<T>::initRadix2() {
+    size_t log_n = 0;
+    while ((size_t(1) << log_n) < n_) {
+        ++log_n;
+    }
+    permutation_.resize(n_);
+    for (size_t i = 0; i < n_; ++i) {
+        size_t rev = 0;
+        for (size_t bit = 0; bit < log_n; ++bit) {
+            rev |= ((i >> bit) & 1) << (log_n - bit - 1);
+        }
+        permutation_[i] = rev;
+    }
+
+    /* every stage gets its own exactly computed twiddles,
+     * so no error accumulates from repeated multiplication */
+    twiddles_re_.resize(n_);
+    twiddles_im_.resize(n_);
+    for (size_t half = 1; half < n_; half <<= 1) {
+        for (size_t j = 0; j < half; ++j) {
+            double angle = M_PI * j / half;
+            twiddles_re_[half + j] = std::cos(angle);
+            twiddles_im_[half + j] = std::sin(angle);
+        }
+    }
+}
+
+/* Decimation in time: the stage with factor factors_[0] splits the input
+ * into p interleaved subsequences, the next one splits each of them again
+ * and so on. Position r_0 * n/p_0 + r_1 * n/(p_0 p_1) + ... therefore
+ * receives input index r_0 + p_0 * (r_1 + p_1 * (...)). */
+template <typename T>
+void FftPlan<T>::initMixedRadix() {
+    size_t rest = n_;
+    while (rest % 4 == 0) {
+        factors_.push_back(4);
+        rest /= 4;
+    }
+    for (size_t p : {2, 3, 5, 7}) {
+        while (rest % p == 0) {
+            factors_.push_back(p);
+            rest /= p;
+        }
+    }
+
+    permutation_.resize(n_);
+    for (size_t index = 0; index < n_; ++index) {
+        size_t rest = index;
+        size_t stride = n_;
+        size_t position = 0;
+        for (size_t p : factors_) {
+            stride /= p;
+            position += (rest % p) * stride;
+            rest /= p;
+        }
+        permutation_[position] = index;
+    }
+
+    size_t m = n_;
+    for (size_t p : factors_) {
+        m /= p;
+        size_t length = p * m;
+        for (size_t r = 1; r < p; ++r) {
+            for (size_t k = 0; k < m; ++k) {
+                double angle = 2.0 * M_PI * static_cast<double>((r * k) % length) / length;
+                twiddles_re_.push_back(std::cos(angle));
+                twiddles_im_.push_back(std::sin(angle));
+            }
+        }
+    }
+}
+
+/* w^(jk) = c_j * c_k * conj(c_(k-j)) with c_j = exp(pi*i * j^2 / n),
+ * so the DFT becomes a convolution of x_j * c_j with conj(c_j) */
+template <typename T>
+void FftPlan<T>::initBluestein() {
+    size_t m = 1;
+    while (m < 2 * n_ - 1) {
+        m <<= 1;
+    }
+    inner_ = std::make_unique<FftPlan<T>>(m);
+
+    chirp_re_.resize(n_);
+    chirp_im_.resize(n_);
+    /* j^2 is kept modulo 2n, which keeps the angle small and exact */
+    size_t square = 0;
+    for (size_t j = 0; j < n_; ++j) {
+        double angle = M_PI * square / n_;
+        chirp_re_[j] = std::cos(angle);
+        chirp_im_[j] = std::sin(angle);
+        square = (square + 2 * j + 1) % (2 * n_);
+    }
+
+    kernel_re_.assign(m, T(0));
+    kernel_im_.assign(m, T(0));
+    for (size_t j = 0; j < n_; ++j) {
+        kernel_re_[j] = chirp_re_[j];
+        kernel_im_[j] = -chirp_im_[j];
+        if (j > 0) {
+            kernel_re_[m - j] = chirp_re_[j];
+            kernel_im_[m - j] = -chirp_im_[j];
+        }
+    }
+    inner_->transform(kernel_re_.data(), kernel_im_.data(), false);
+}
+
+template <typename T>
+void FftPlan<T>::initFourStep() {
+    /* columns is the largest number whose square divides n, so rows is a
+     * multiple of it (by at most 2 * 3 * 5 * 7) and the final transpose can
+     * be done in place */
+    columns_ = fourStepColumns(n_);
+    rows_ = n_ / columns_;
+    column_plan_ = std::make_unique<FftPlan<T>>(rows_);
+    row_plan_ = std::make_unique<FftPlan<T>>(columns_);
+
+    twiddles_re_.resize(rows_ + columns_);
+    twiddles_im_.resize(rows_ + columns_);
+    for (size_t l = 0; l < rows_; ++l) {
+        double angle = 2.0 * M_PI * l / n_;
+        twiddles_re_[l] = std::cos(angle);
+        twiddles_im_[l] = std::sin(angle);
+    }
+    for (size_t h = 0; h < columns_; ++h) {
+        double angle = 2.0 * M_PI * h / columns_;
+        twiddles_re_[rows_ + h] = std::cos(angle);
+        twiddles_im_[rows_ + h] = std::sin(angle);
+    }
+}
+
+/* In-place transpose of a rows x columns matrix whose rows are a multiple q
+ * of columns; an element is `width` consecutive values (2 for interleaved
+ * complex data). The q square blocks of columns rows are transposed first by
+ * swapping tiles across the diagonal. Block b then holds, in pieces of
+ * columns elements, the parts of the result rows that start at b * columns:
+ * the piece at b * columns + k1 belongs at k1 * q + b. Moving the pieces is
+ * a transpose of a q x columns matrix of pieces, done by following its
+ * cycles with one spare piece, so nothing of the size of the data is
+ * allocated. */
+template <typename T>
+static void transposeInPlace(
+    ThreadPool& pool,
+    T* data,
+    size_t rows,
+    size_t columns,
+    size_t width
+) {
+    size_t q = rows / columns;
+    size_t block_size = columns * columns * width;
+    size_t tiles = (columns + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+    pool.parallelFor(q * tiles, [&](size_t begin, size_t end) {
+        for (size_t task = begin; task < end; ++task) {
+            T* block = data + (task / tiles) * block_size;
+            size_t r0 = (task % tiles) * TRANSPOSE_TILE;
+            size_t r_end = std::min(columns, r0 + TRANSPOSE_TILE);
+            for (size_t c0 = r0; c0 < columns; c0 += TRANSPOSE_TILE) {
+                size_t c_end = std::min(columns, c0 + TRANSPOSE_TILE);
+                for (size_t r = r0; r < r_end; ++r) {
+                    for (size_t c = std::max(c0, r + 1); c < c_end; ++c) {
+                        std::swap_ranges(
+                            block + (r * columns + c) * width,
+                            block + (r * columns + c + 1) * width,
+                            block + (c * columns + r) * width
+                        );
+                    }
+                }
+            }
+        }
+    });
+    if (q == 1) {
         return;
     }
-    std::vector<std::complex<double>> data_odd = getHalfData(data, false);
-    std::vector<std::complex<double>> data_even = getHalfData(data, true);
 
-    fft(data_odd, reversed);
-    fft(data_even, reversed);
+    size_t pieces = q * columns;
+    size_t piece_size = columns * width;
+    T* spare = workspace<T>(COLUMN_SLOT, piece_size);
+    unsigned char* moved = workspace<unsigned char>(COLUMN_SLOT, pieces);
+    std::fill(moved, moved + pieces, 0);
+    for (size_t start = 0; start < pieces; ++start) {
+        if (moved[start]) {
+            continue;
+        }
+        std::copy(data + start * piece_size, data + (start + 1) * piece_size, spare);
+        size_t to = start;
+        for (;;) {
+            moved[to] = 1;
+            /* the piece that belongs at `to` */
+            size_t from = (to % q) * columns + to / q;
+            if (from == start) {
+                break;
+            }
+            std::copy(data + from * piece_size, data + (from + 1) * piece_size, data + to * piece_size);
+            to = from;
+        }
+        std::copy(spare, spare + piece_size, data + to * piece_size);
+    }
+}
+
+template <typename T>
+size_t FftPlan<T>::size() const {
+    return n_;
+}
+
+template <typename T>
+const char* FftPlan<T>::kernelName() const {
+    return kernels_->name;
+}
+
+template <typename T>
+void FftPlan<T>::forward(std::vector<std::complex<T>>& data) const {
+    assert(data.size() == n_);
+    transform(data.data(), false);
+}
+
+template <typename T>
+void FftPlan<T>::inverse(std::vector<std::complex<T>>& data) const {
+    assert(data.size() == n_);
+    transform(data.data(), true);
+}
+
+/* The inverse transform is the forward one with real and imaginary parts
+ * swapped on input and output, which on split arrays is just swapping the
+ * pointers. */
+template <typename T>
+void FftPlan<T>::transform(std::complex<T>* data, bool reversed) const {
+    T scale = reversed ? T(1) / n_ : T(1);
+
+    if (strategy_ == Strategy::FourStep) {
+        /* no copy of the data: both passes and the transpose work on the
+         * interleaved values in place, rows are scaled on the way back */
+        T* values = reinterpret_cast<T*>(data);
+        if (reversed) {
+            runFourStepPasses(values + 1, values, 2, scale);
+        } else {
+            runFourStepPasses(values, values + 1, 2, scale);
+        }
+        transposeInPlace(pool(), values, rows_, columns_, 2);
+        return;
+    }
+
+    T* re = workspace<T>(SPLIT_SLOT, 2 * n_);
+    T* im = re + n_;
+
+    /* the input permutation is folded into the deinterleaving pass */
+    if (permutation_.empty()) {
+        for (size_t i = 0; i < n_; ++i) {
+            re[i] = data[i].real();
+            im[i] = data[i].imag();
+        }
+    } else {
+        for (size_t i = 0; i < n_; ++i) {
+            const std::complex<T>& value = data[permutation_[i]];
+            re[i] = value.real();
+            im[i] = value.imag();
+        }
+    }
 
-    double angle = 1;
     if (reversed) {
-        angle = -1;
+        runForward(im, re);
+    } else {
+        runForward(re, im);
     }
-    size_t n = data.size();
-    angle *= 2.0 * M_PI / n;
+    for (size_t i = 0; i < n_; ++i) {
+        data[i] = std::complex<T>(re[i] * scale, im[i] * scale);
+    }
+}
 
-    std::complex<double> w_cur(1);
-    std::complex<double> w_step(std::cos(angle), std::sin(angle));
+template <typename T>
+void FftPlan<T>::transform(T* re, T* im, bool reversed) const {
+    if (strategy_ == Strategy::Radix2) {
+        /* bit reversal is an involution and can be done by swaps */
+        for (size_t i = 0; i < n_; ++i) {
+            if (i < permutation_[i]) {
+                std::swap(re[i], re[permutation_[i]]);
+                std::swap(im[i], im[permutation_[i]]);
+            }
+        }
+    } else if (strategy_ == Strategy::MixedRadix) {
+        T* tmp_re = workspace<T>(SPLIT_SLOT, 2 * n_);
+        T* tmp_im = tmp_re + n_;
+        for (size_t i = 0; i < n_; ++i) {
+            tmp_re[i] = re[permutation_[i]];
+            tmp_im[i] = im[permutation_[i]];
+        }
+        std::copy(tmp_re, tmp_re + n_, re);
+        std::copy(tmp_im, tmp_im + n_, im);
+    }
 
-    for (size_t i = 0; i < n / 2; ++i) {
-        data[i] = data_odd[i] + w_cur * data_even[i];
-        data[i + n / 2] = data_odd[i] - w_cur * data_even[i];
-        if (reversed) {
-            data[i] /= 2;
-            data[i + n / 2] /= 2;
+    if (reversed) {
+        runForward(im, re);
+        T scale = T(1) / n_;
+        for (size_t i = 0; i < n_; ++i) {
+            re[i] *= scale;
+            im[i] *= scale;
         }
-        w_cur *= w_step;
+    } else {
+        runForward(re, im);
     }
+}
 
+template <typename T>
+void FftPlan<T>::runForward(T* re, T* im) const {
+    switch (strategy_) {
+        case Strategy::Radix2:
+            runStages(re, im);
+            break;
+        case Strategy::MixedRadix:
+            runMixedStages(re, im);
+            break;
+        case Strategy::Bluestein:
+            runBluestein(re, im);
+            break;
+        case Strategy::FourStep:
+            runFourStep(re, im);
+            break;
+    }
 }
 
-void fftStraight(std::vector<std::complex<double>>& data) {
-    fft(data, false);
+template <typename T>
+void FftPlan<T>::runStages(T* re, T* im) const {
+    const T* w_re = twiddles_re_.data();
+    const T* w_im = twiddles_im_.data();
+    size_t half = 1;
+    size_t log_n = 0;
+    while ((size_t(1) << log_n) < n_) {
+        ++log_n;
+    }
+    if (log_n % 2 == 1) {
+        kernels_->radix2(re, im, w_re, w_im, n_, half);
+        half <<= 1;
+    }
+    for (; half < n_; half <<= 2) {
+        kernels_->radix4(re, im, w_re, w_im, n_, half);
+    }
 }
-void fftReversed(std::vector<std::complex<double>>& data) {
-    fft(data, true);
+
+/* Stages run from the innermost factor outwards. A stage of length L = p * m
+ * holds p transforms of size m one after another; for every k < m it twists
+ * the p values at stride m by w_L^(r*k) and applies a DFT of size p to them. */
+template <typename T>
+void FftPlan<T>::runMixedStages(T* re, T* im) const {
+    /* twiddles are stored outermost stage first, so walk them backwards */
+    size_t offset = twiddles_re_.size();
+    size_t m = 1;
+
+    for (size_t stage = factors_.size(); stage-- > 0;) {
+        size_t p = factors_[stage];
+        size_t sub = m;
+        m *= p;
+        offset -= (p - 1) * sub;
+        const T* w_re = twiddles_re_.data() + offset;
+        const T* w_im = twiddles_im_.data() + offset;
+
+        T root_re[7];
+        T root_im[7];
+        for (size_t j = 0; j < p; ++j) {
+            double angle = 2.0 * M_PI * j / p;
+            root_re[j] = std::cos(angle);
+            root_im[j] = std::sin(angle);
+        }
+
+        for (size_t start = 0; start < n_; start += m) {
+            T* block_re = re + start;
+            T* block_im = im + start;
+            for (size_t k = 0; k < sub; ++k) {
+                T t_re[7];
+                T t_im[7];
+                t_re[0] = block_re[k];
+                t_im[0] = block_im[k];
+                for (size_t r = 1; r < p; ++r) {
+                    T x_re = block_re[r * sub + k];
+                    T x_im = block_im[r * sub + k];
+                    T c = w_re[(r - 1) * sub + k];
+                    T s = w_im[(r - 1) * sub + k];
+                    t_re[r] = c * x_re - s * x_im;
+                    t_im[r] = c * x_im + s * x_re;
+                }
+
+                if (p == 2) {
+                    block_re[k] = t_re[0] + t_re[1];
+                    block_im[k] = t_im[0] + t_im[1];
+                    block_re[sub + k] = t_re[0] - t_re[1];
+                    block_im[sub + k] = t_im[0] - t_im[1];
+                } else if (p == 4) {
+                    /* w_4 = i */
+                    T s02_re = t_re[0] + t_re[2];
+                    T s02_im = t_im[0] + t_im[2];
+                    T d02_re = t_re[0] - t_re[2];
+                    T d02_im = t_im[0] - t_im[2];
+                    T s13_re = t_re[1] + t_re[3];
+                    T s13_im = t_im[1] + t_im[3];
+                    T d13_re = t_re[1] - t_re[3];
+                    T d13_im = t_im[1] - t_im[3];
+                    block_re[k] = s02_re + s13_re;
+                    block_im[k] = s02_im + s13_im;
+                    block_re[sub + k] = d02_re - d13_im;
+                    block_im[sub + k] = d02_im + d13_re;
+                    block_re[2 * sub + k] = s02_re - s13_re;
+                    block_im[2 * sub + k] = s02_im - s13_im;
+                    block_re[3 * sub + k] = d02_re + d13_im;
+                    block_im[3 * sub + k] = d02_im - d13_re;
+                } else {
+                    for (size_t q = 0; q < p; ++q) {
+                        T sum_re = t_re[0];
+                        T sum_im = t_im[0];
+                        for (size_t r = 1; r < p; ++r) {
+                            size_t j = (r * q) % p;
+                            sum_re += root_re[j] * t_re[r] - root_im[j] * t_im[r];
+                            sum_im += root_re[j] * t_im[r] + root_im[j] * t_re[r];
+                        }
+                        block_re[q * sub + k] = sum_re;
+                        block_im[q * sub + k] = sum_im;
+                    }
+                }
+            }
+        }
+    }
 }
 
-void commpressData(std::vector<std::complex<double>>& data, char percents) {
-    fftStraight(data);
-    size_t zero_start = data.size() / 4;
-    for(size_t i = zero_start; i < data.size(); i++){
-        data[i] = 0;
+/* The data is viewed as a rows x columns matrix M[j2][j1] = x[j1 + columns * j2].
+ * With k = k2 + rows * k1
+ *   X[k] = sum_j1 w_columns^(j1 k1) * w_n^(j1 k2) * sum_j2 M[j2][j1] w_rows^(j2 k2),
+ * so every column gets a transform of length rows and the w_n^(j1 k2) twist,
+ * then every row a transform of length columns. Columns are gathered a few at
+ * a time into a small contiguous buffer, so each transform runs in cache;
+ * columns and rows are spread over the pool. Both passes write back where
+ * they read, the result is left transposed:
+ * re/im[(k2 * columns + k1) * step] = X[k2 + rows * k1] * scale.
+ * Values are step elements apart, which lets the complex interface work on
+ * interleaved data directly. */
+template <typename T>
+void FftPlan<T>::runFourStepPasses(T* re, T* im, size_t step, T scale) const {
+    ThreadPool& pool = this->pool();
+
+    size_t groups = (columns_ + FOUR_STEP_GROUP - 1) / FOUR_STEP_GROUP;
+    pool.parallelFor(groups, [&](size_t begin, size_t end) {
+        size_t stride = rows_ + FOUR_STEP_PADDING;
+        T* column_re = workspace<T>(COLUMN_SLOT, 2 * FOUR_STEP_GROUP * stride + FOUR_STEP_PADDING);
+        T* column_im = column_re + FOUR_STEP_GROUP * stride + FOUR_STEP_PADDING;
+        const T* fine_re = twiddles_re_.data();
+        const T* fine_im = twiddles_im_.data();
+        const T* coarse_re = fine_re + rows_;
+        const T* coarse_im = fine_im + rows_;
+
+        for (size_t group = begin; group < end; ++group) {
+            size_t first = group * FOUR_STEP_GROUP;
+            size_t count = std::min(FOUR_STEP_GROUP, columns_ - first);
+
+            for (size_t j2 = 0; j2 < rows_; ++j2) {
+                for (size_t c = 0; c < count; ++c) {
+                    size_t index = (j2 * columns_ + first + c) * step;
+                    column_re[c * stride + j2] = re[index];
+                    column_im[c * stride + j2] = im[index];
+                }
+            }
+
+            for (size_t c = 0; c < count; ++c) {
+                T* line_re = column_re + c * stride;
+                T* line_im = column_im + c * stride;
+                column_plan_->transform(line_re, line_im, false);
+
+                /* w_n^(j1 k2) = coarse[j1 k2 / rows] * fine[j1 k2 % rows],
+                 * j1 < columns <= rows, so both indices move by at most one wrap */
+                size_t j1 = first + c;
+                size_t coarse = 0;
+                size_t fine = 0;
+                for (size_t k2 = 0; k2 < rows_; ++k2) {
+                    T w_re = coarse_re[coarse] * fine_re[fine] - coarse_im[coarse] * fine_im[fine];
+                    T w_im = coarse_re[coarse] * fine_im[fine] + coarse_im[coarse] * fine_re[fine];
+                    T x_re = line_re[k2];
+                    T x_im = line_im[k2];
+                    line_re[k2] = w_re * x_re - w_im * x_im;
+                    line_im[k2] = w_re * x_im + w_im * x_re;
+                    fine += j1;
+                    if (fine >= rows_) {
+                        fine -= rows_;
+                        ++coarse;
+                    }
+                }
+            }
+
+            for (size_t k2 = 0; k2 < rows_; ++k2) {
+                for (size_t c = 0; c < count; ++c) {
+                    size_t index = (k2 * columns_ + first + c) * step;
+                    re[index] = column_re[c * stride + k2];
+                    im[index] = column_im[c * stride + k2];
+                }
+            }
+        }
+    });
+
+    pool.parallelFor(rows_, [&](size_t begin, size_t end) {
+        for (size_t k2 = begin; k2 < end; ++k2) {
+            T* row_re = re + k2 * columns_ * step;
+            T* row_im = im + k2 * columns_ * step;
+            if (step == 1 && scale == T(1)) {
+                row_plan_->transform(row_re, row_im, false);
+                continue;
+            }
+            T* line_re = workspace<T>(COLUMN_SLOT, 2 * columns_);
+            T* line_im = line_re + columns_;
+            for (size_t k1 = 0; k1 < columns_; ++k1) {
+                line_re[k1] = row_re[k1 * step];
+                line_im[k1] = row_im[k1 * step];
+            }
+            row_plan_->transform(line_re, line_im, false);
+            for (size_t k1 = 0; k1 < columns_; ++k1) {
+                row_re[k1 * step] = line_re[k1] * scale;
+                row_im[k1 * step] = line_im[k1] * scale;
+            }
+        }
+    });
+}
+
+template <typename T>
+void FftPlan<T>::runFourStep(T* re, T* im) const {
+    ThreadPool& pool = this->pool();
+    runFourStepPasses(re, im, 1, T(1));
+    transposeInPlace(pool, re, rows_, columns_, 1);
+    transposeInPlace(pool, im, rows_, columns_, 1);
+}
+
+template <typename T>
+void FftPlan<T>::runBluestein(T* re, T* im) const {
+    size_t m = inner_->size();
+    T* a_re = workspace<T>(BLUESTEIN_SLOT, 2 * m);
+    T* a_im = a_re + m;
+
+    for (size_t j = 0; j < n_; ++j) {
+        a_re[j] = re[j] * chirp_re_[j] - im[j] * chirp_im_[j];
+        a_im[j] = re[j] * chirp_im_[j] + im[j] * chirp_re_[j];
+    }
+    std::fill(a_re + n_, a_re + m, T(0));
+    std::fill(a_im + n_, a_im + m, T(0));
+
+    inner_->transform(a_re, a_im, false);
+    for (size_t k = 0; k < m; ++k) {
+        T x_re = a_re[k];
+        T x_im = a_im[k];
+        a_re[k] = x_re * kernel_re_[k] - x_im * kernel_im_[k];
+        a_im[k] = x_re * kernel_im_[k] + x_im * kernel_re_[k];
+    }
+    inner_->transform(a_re, a_im, true);
+
+    for (size_t k = 0; k < n_; ++k) {
+        re[k] = a_re[k] * chirp_re_[k] - a_im[k] * chirp_im_[k];
+        im[k] = a_re[k] * chirp_im_[k] + a_im[k] * chirp_re_[k];
+    }
+}
+
+template <typename T>
+RealFftPlan<T>::RealFftPlan(size_t n) : n_(n), plan_(n % 2 == 0 ? n / 2 : n), fine_bits_(0) {
+    assert(n >= 1);
+    size_t count = n / 4 + 1;
+    size_t fine_count = 1;
+    while (fine_count < count && (count <= REAL_TWIDDLE_TABLE_MAX || fine_count * fine_count < count)) {
+        fine_count <<= 1;
+        ++fine_bits_;
+    }
+    size_t coarse_count = (count - 1) / fine_count + 1;
+    twiddles_.resize(fine_count + coarse_count);
+    for (size_t l = 0; l < fine_count; ++l) {
+        double angle = 2.0 * M_PI * l / n;
+        twiddles_[l] = std::complex<T>(std::cos(angle), std::sin(angle));
+    }
+    for (size_t h = 0; h < coarse_count; ++h) {
+        double angle = 2.0 * M_PI * (h * fine_count) / n;
+        twiddles_[fine_count + h] = std::complex<T>(std::cos(angle), std::sin(angle));
+    }
+}
+
+template <typename T>
+std::complex<T> RealFftPlan<T>::twiddle(size_t k) const {
+    size_t fine_count = size_t(1) << fine_bits_;
+    const std::complex<T>& fine = twiddles_[k & (fine_count - 1)];
+    const std::complex<T>& coarse = twiddles_[fine_count + (k >> fine_bits_)];
+    return std::complex<T>(
+        coarse.real() * fine.real() - coarse.imag() * fine.imag(),
+        coarse.real() * fine.imag() + coarse.imag() * fine.real()
+    );
+}
+
+template <typename T>
+size_t RealFftPlan<T>::size() const {
+    return n_;
+}
+
+template <typename T>
+size_t RealFftPlan<T>::spectrumSize() const {
+    return n_ / 2 + 1;
+}
+
+/* Even and odd samples are packed into one complex sequence z = e + i*o,
+ * its spectrum Z is split back into E and O using Hermitian symmetry
+ * and X[k] = E[k] + w^k * O[k]. Bins k and n/2 - k are done together
+ * so the whole thing works in place. */
+template <typename T>
+void RealFftPlan<T>::forward(const T* samples, std::complex<T>* spectrum) const {
+    if (n_ % 2 == 1) {
+        T* re = workspace<T>(REAL_SLOT, 2 * n_);
+        T* im = re + n_;
+        std::copy(samples, samples + n_, re);
+        std::fill(im, im + n_, T(0));
+        plan_.transform(re, im, false);
+        for (size_t k = 0; k < spectrumSize(); ++k) {
+            spectrum[k] = std::complex<T>(re[k], im[k]);
+        }
+        return;
+    }
+
+    size_t half = n_ / 2;
+    for (size_t m = 0; m < half; ++m) {
+        spectrum[m] = std::complex<T>(samples[2 * m], samples[2 * m + 1]);
+    }
+    plan_.transform(spectrum, false);
+
+    T z0_re = spectrum[0].real();
+    T z0_im = spectrum[0].imag();
+    spectrum[0] = z0_re + z0_im;
+    spectrum[half] = z0_re - z0_im;
+
+    for (size_t k = 1; k <= half / 2; ++k) {
+        size_t j = half - k;
+        std::complex<T> z_k = spectrum[k];
+        std::complex<T> z_j = spectrum[j];
+
+        std::complex<T> even = T(0.5) * (z_k + std::conj(z_j));
+        std::complex<T> odd = T(0.5) * (z_k - std::conj(z_j));
+        odd = std::complex<T>(odd.imag(), -odd.real());   // odd /= i
+        std::complex<T> w = twiddle(k);
+        std::complex<T> t(
+            w.real() * odd.real() - w.imag() * odd.imag(),
+            w.real() * odd.imag() + w.imag() * odd.real()
+        );
+        spectrum[k] = even + t;
+        /* X[n/2 - k] = conj(E[k]) - w^(-k) * conj(O[k]) = conj(E[k] - w^k * O[k]) */
+        spectrum[j] = std::conj(even - t);
     }
-    fftReversed(data);
 }
+
+template <typename T>
+void RealFftPlan<T>::inverse(const std::complex<T>* spectrum, T* samples) const {
+    if (n_ % 2 == 1) {
+        T* re = workspace<T>(REAL_SLOT, 2 * n_);
+        T* im = re + n_;
+        for (size_t k = 0; k < spectrumSize(); ++k) {
+            re[k] = spectrum[k].real();
+            im[k] = spectrum[k].imag();
+        }
+        for (size_t k = spectrumSize(); k < n_; ++k) {
+            re[k] = spectrum[n_ - k].real();
+            im[k] = -spectrum[n_ - k].imag();
+        }
+        plan_.transform(re, im, true);
+        std::copy(re, re + n_, samples);
+        return;
+    }
+
+    size_t half = n_ / 2;
+    /* samples are written as z[m] = x[2m] + i*x[2m+1] */
+    std::complex<T>* z = reinterpret_cast<std::complex<T>*>(samples);
+
+    T x0 = spectrum[0].real();
+    T x_half = spectrum[half].real();
+    z[0] = std::complex<T>(T(0.5) * (x0 + x_half), T(0.5) * (x0 - x_half));
+
+    for (size_t k = 1; k <= half / 2; ++k) {
+        size_t j = half - k;
+        std::complex<T> x_k = spectrum[k];
+        std::complex<T> x_j = spectrum[j];
+
+        std::complex<T> even = T(0.5) * (x_k + std::conj(x_j));
+        std::complex<T> diff = T(0.5) * (x_k - std::conj(x_j));
+        std::complex<T> w = twiddle(k);
+        /* odd = diff / w^k = diff * conj(w^k) */
+        std::complex<T> odd(
+            w.real() * diff.real() + w.imag() * diff.imag(),
+            w.real() * diff.imag() - w.imag() * diff.real()
+        );
+        std::complex<T> i_odd(-odd.imag(), odd.real());
+        z[k] = even + i_odd;
+        /* E[j] = conj(E[k]), O[j] = conj(O[k]) */
+        z[j] = std::conj(even) + std::complex<T>(odd.imag(), odd.real());
+    }
+
+    plan_.transform(z, true);
+}
+
+/* fftStraight/fftReversed are usually called repeatedly with the same size,
+ * so the last built plan is kept around instead of rebuilding the tables */
+template <typename T>
+static const FftPlan<T>& cachedPlan(size_t n) {
+    thread_local std::unique_ptr<FftPlan<T>> plan;
+    if (!plan || plan->size() != n) {
+        plan = std::make_unique<FftPlan<T>>(n);
+    }
+    return *plan;
+}
+
+template <typename T>
+void fftStraight(std::vector<std::complex<T>>& data) {
+    cachedPlan<T>(data.size()).forward(data);
+}
+
+template <typename T>
+void fftReversed(std::vector<std::complex<T>>& data) {
+    cachedPlan<T>(data.size()).inverse(data);
+}
+
+size_t fastRealFftSize(size_t n) {
+    for (size_t size = n + n % 2;; size += 2) {
+        size_t rest = size / 2;
+        for (size_t p : {2, 3, 5, 7}) {
+            while (rest % p == 0) {
+                rest /= p;
+            }
+        }
+        if (rest <= 1) {
+            return size;
+        }
+    }
+}
+
+size_t compressionFftSize(size_t n) {
+    return fastRealFftSize(n);
+}
+
+size_t decimationFftSize(size_t n, size_t k) {
+    return fastRealFftSize((n + k - 1) / k);
+}
+
+/* The magnitude of the given rank (0 is the smallest) without a copy of the
+ * magnitudes: non-negative floating point values are ordered like their bit
+ * patterns, so the answer is found digit by digit from the top, one counting
+ * pass over the values per SELECT_DIGIT_BITS bits. Same result as
+ * nth_element on the magnitudes. */
+template <typename V>
+static decltype(std::norm(V())) selectMagnitude(const V* values, size_t count, size_t rank) {
+    typedef decltype(std::norm(V())) Magnitude;
+    typedef typename std::conditional<sizeof(Magnitude) == 8, uint64_t, uint32_t>::type Bits;
+    const int bits = sizeof(Bits) * 8;
+    const size_t buckets = size_t(1) << SELECT_DIGIT_BITS;
+    size_t* histogram = workspace<size_t>(SELECT_SLOT, buckets);
+
+    Bits prefix = 0;
+    for (int shift = bits - SELECT_DIGIT_BITS; shift >= 0; shift -= SELECT_DIGIT_BITS) {
+        /* only values that agree with the digits found so far are counted */
+        Bits known = shift + SELECT_DIGIT_BITS >= bits ? 0 : ~Bits(0) << (shift + SELECT_DIGIT_BITS);
+        std::fill(histogram, histogram + buckets, 0);
+        for (size_t i = 0; i < count; ++i) {
+            Magnitude magnitude = std::norm(values[i]);
+            Bits pattern;
+            std::memcpy(&pattern, &magnitude, sizeof(pattern));
+            if ((pattern & known) == prefix) {
+                ++histogram[(pattern >> shift) & (buckets - 1)];
+            }
+        }
+        size_t digit = 0;
+        while (rank >= histogram[digit]) {
+            rank -= histogram[digit];
+            ++digit;
+        }
+        prefix |= Bits(digit) << shift;
+    }
+    Magnitude magnitude;
+    std::memcpy(&magnitude, &prefix, sizeof(magnitude));
+    return magnitude;
+}
+
+template <typename V>
+void keepLargest(V* values, size_t count, char percents) {
+    typedef decltype(std::norm(V())) Magnitude;
+    size_t kept = percents <= 0 ? 0 : std::max<size_t>(1, count * std::min<size_t>(percents, 100) / 100);
+    if (kept >= count) {
+        return;
+    }
+    if (kept == 0) {
+        std::fill(values, values + count, V(0));
+        return;
+    }
+
+    /* long spectra are not copied, the copy would be as large as the data */
+    Magnitude threshold;
+    if (count >= SELECT_COPY_MAX) {
+        threshold = selectMagnitude(values, count, count - kept);
+    } else {
+        Magnitude* magnitudes = workspace<Magnitude>(SELECT_SLOT, count);
+        for (size_t i = 0; i < count; ++i) {
+            magnitudes[i] = std::norm(values[i]);
+        }
+        std::nth_element(magnitudes, magnitudes + (count - kept), magnitudes + count);
+        threshold = magnitudes[count - kept];
+    }
+
+    /* everything above the threshold stays, equal values fill what is left */
+    size_t above = 0;
+    for (size_t i = 0; i < count; ++i) {
+        above += std::norm(values[i]) > threshold;
+    }
+    size_t equal = kept - above;
+    for (size_t i = 0; i < count; ++i) {
+        Magnitude magnitude = std::norm(values[i]);
+        if (magnitude > threshold) {
+            continue;
+        }
+        if (magnitude == threshold && equal > 0) {
+            --equal;
+        } else {
+            values[i] = V(0);
+        }
+    }
+}
+
+template <typename T>
+void commpressData(std::vector<std::complex<T>>& data, char percents) {
+    FftPlan<T> plan(data.size());
+    plan.forward(data);
+    keepLargest(data.data(), data.size(), percents);
+    plan.inverse(data);
+}
+
+template <typename T>
+void commpressData(std::vector<T>& data, char percents) {
+    if (data.empty()) {
+        return;
+    }
+    RealFftPlan<T> plan(compressionFftSize(data.size()));
+    commpressData(data, plan, percents);
+}
+
+template <typename T>
+void commpressData(std::vector<T>& data, const RealFftPlan<T>& plan, char percents) {
+    size_t n = data.size();
+    if (n == 0) {
+        return;
+    }
+    assert(plan.size() >= n);
+    /* the spectrum is kept in the sample buffer itself, a longer plan
+     * zero-pads the samples */
+    data.resize(plan.size() + 2);
+    std::complex<T>* spectrum = reinterpret_cast<std::complex<T>*>(data.data());
+
+    {
+        ScopedTimer timer(STAGE_FORWARD, n);
+        plan.forward(data.data(), spectrum);
+    }
+    {
+        ScopedTimer timer(STAGE_SELECT, n);
+        keepLargest(spectrum, plan.spectrumSize(), percents);
+    }
+    {
+        ScopedTimer timer(STAGE_INVERSE, n);
+        plan.inverse(spectrum, data.data());
+    }
+
+    data.resize(n);
+}
+
+template <typename T>
+void decimateData(std::vector<T>& data, const RealFftPlan<T>& plan, const RealFftPlan<T>& target, char percents) {
+    size_t n = data.size();
+    size_t m = target.size();
+    size_t k = plan.size() / m;
+    assert(plan.size() == k * m && (n + k - 1) / k <= m);
+    /* the signal is zero-padded to k * m samples, so bin j of the long
+     * spectrum is bin j of the short one and the result is sampled at
+     * every k-th input position */
+    data.resize(plan.size() + 2);
+    std::complex<T>* spectrum = reinterpret_cast<std::complex<T>*>(data.data());
+    {
+        ScopedTimer timer(STAGE_FORWARD, n);
+        plan.forward(data.data(), spectrum);
+    }
+
+    /* the inverse divides by m instead of k * m; the new Nyquist bin must
+     * be real, its sine part cannot be represented at the lower rate */
+    size_t bins = target.spectrumSize();
+    T scale = T(1) / T(k);
+    for (size_t j = 0; j < bins; ++j) {
+        spectrum[j] *= scale;
+    }
+    if (m % 2 == 0) {
+        spectrum[m / 2] = spectrum[m / 2].real();
+    }
+    {
+        ScopedTimer timer(STAGE_SELECT, n);
+        keepLargest(spectrum, bins, percents);
+    }
+    {
+        ScopedTimer timer(STAGE_INVERSE, n);
+        target.inverse(spectrum, data.data());
+    }
+
+    data.resize((n + k - 1) / k);
+}
+
+template class FftPlan<float>;
+template class FftPlan<double>;
+
+template class RealFftPlan<float>;
+template class RealFftPlan<double>;
+
+template void fftStraight(std::vector<std::complex<float>>& data);
+template void fftStraight(std::vector<std::complex<double>>& data);
+
+template void fftReversed(std::vector<std::complex<float>>& data);
+template void fftReversed(std::vector<std::complex<double>>& data);
+
+template void keepLargest(float* values, size_t count, char percents);
+template void keepLargest(double* values, size_t count, char percents);
+template void keepLargest(std::complex<float>* values, size_t count, char percents);
+template void keepLargest(std::complex<double>* values, size_t count, char percents);
+
+template void commpressData(std::vector<std::complex<float>>& data, char percents);
+template void commpressData(std::vector<std::complex<double>>& data, char percents);
+
+template void commpressData(std::vector<float>& data, char percents);
+template void commpressData(std::vector<double>& data, char percents);
+
+template void commpressData(std::vector<float>& data, const RealFftPlan<float>& plan, char percents);
+template void commpressData(std::vector<double>& data, const RealFftPlan<double>& plan, char percents);
+
+template void decimateData(std::vector<float>& data, const RealFftPlan<float>& plan, const RealFftPlan<float>& target, char percents);
+template void decimateData(std::vector<double>& data, const RealFftPlan<double>& plan, const RealFftPlan<double>& target, char percents);
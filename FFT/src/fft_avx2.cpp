@@ -0,0 +1,22 @@
+#include "fft_kernels.h"
+
+/* built with the matching -m flag, selected at runtime by CPUID */
+template <>
+const FftKernels<float>& avx2FftKernels<float>() {
+    static const FftKernels<float> kernels = {
+        "avx2",
+        radix2Pass<float, Avx2Isa>,
+        radix4Pass<float, Avx2Isa>
+    };
+    return kernels;
+}
+
+template <>
+const FftKernels<double>& avx2FftKernels<double>() {
+    static const FftKernels<double> kernels = {
+        "avx2",
+        radix2Pass<double, Avx2Isa>,
+        radix4Pass<double, Avx2Isa>
+    };
+    return kernels;
+}
@@ -0,0 +1,22 @@
+#include "fft_kernels.h"
+
+/* built with the matching -m flag, selected at runtime by CPUID */
+template <>
+const FftKernels<float>& avx512FftKernels<float>() {
+    static const FftKernels<float> kernels = {
+        "avx512",
+        radix2Pass<float, Avx512Isa>,
+        radix4Pass<float, Avx512Isa>
+    };
+    return kernels;
+}
+
+template <>
+const FftKernels<double>& avx512FftKernels<double>() {
+    static const FftKernels<double> kernels = {
+        "avx512",
+        radix2Pass<double, Avx512Isa>,
+        radix4Pass<double, Avx512Isa>
+    };
+    return kernels;
+}
@@ -0,0 +1,22 @@
+#include "fft_kernels.h"
+
+/* built with the matching -m flag, selected at runtime by CPUID */
+template <>
+const FftKernels<float>& sse2FftKernels<float>() {
+    static const FftKernels<float> kernels = {
+        "sse2",
+        radix2Pass<float, Sse2Isa>,
+        radix4Pass<float, Sse2Isa>
+    };
+    return kernels;
+}
+
+template <>
+const FftKernels<double>& sse2FftKernels<double>() {
+    static const FftKernels<double> kernels = {
+        "sse2",
+        radix2Pass<double, Sse2Isa>,
+        radix4Pass<double, Sse2Isa>
+    };
+    return kernels;
+}
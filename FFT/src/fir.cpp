@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "fir.h"
+#include "stats.h"
+
+/* blocks are at least this many times longer than the filter,
+ * so most of every transform produces output */
+const size_t FIR_BLOCK_FACTOR = 4;
+const size_t FIR_MIN_BLOCK = 64;
+/* the design grid is this many times finer than the taps */
+const size_t FIR_GRID_FACTOR = 16;
+/* width of the ramp the named filters request, in Hz; the Blackman window
+ * widens the actual transition to about 5.5 * sample rate / taps */
+const double FIR_TRANSITION = 100;
+
+static size_t firBlockSize(size_t taps) {
+    size_t n = FIR_MIN_BLOCK;
+    while (n < FIR_BLOCK_FACTOR * taps) {
+        n <<= 1;
+    }
+    return n;
+}
+
+template <typename T>
+FirResponse<T>::FirResponse(const std::vector<T>& taps) :
+    taps_(taps.size()),
+    plan_(firBlockSize(taps.size())) {
+
+    assert(!taps.empty());
+    std::vector<T> padded(plan_.size() + 2, T(0));
+    std::copy(taps.begin(), taps.end(), padded.begin());
+    spectrum_.resize(plan_.spectrumSize());
+    plan_.forward(padded.data(), spectrum_.data());
+}
+
+template <typename T>
+size_t FirResponse<T>::taps() const {
+    return taps_;
+}
+
+template <typename T>
+size_t FirResponse<T>::blockSize() const {
+    return plan_.size();
+}
+
+template <typename T>
+size_t FirResponse<T>::step() const {
+    return plan_.size() - taps_ + 1;
+}
+
+template <typename T>
+const RealFftPlan<T>& FirResponse<T>::plan() const {
+    return plan_;
+}
+
+template <typename T>
+const std::complex<T>* FirResponse<T>::spectrum() const {
+    return spectrum_.data();
+}
+
+template <typename T>
+OverlapSaveFilter<T>::OverlapSaveFilter(std::shared_ptr<const FirResponse<T>> response) :
+    response_(std::move(response)),
+    input_(response_->blockSize(), T(0)),
+    filled_(0),
+    block_(response_->blockSize() + 2),
+    skip_((response_->taps() - 1) / 2),
+    pushed_(0),
+    produced_(0),
+    counted_(0) {
+}
+
+template <typename T>
+void OverlapSaveFilter<T>::push(const T* samples, size_t count, std::vector<T>& out) {
+    size_t history = response_->taps() - 1;
+    size_t step = response_->step();
+    pushed_ += count;
+    while (count > 0) {
+        size_t taken = std::min(count, step - filled_);
+        std::copy(samples, samples + taken, input_.begin() + history + filled_);
+        filled_ += taken;
+        samples += taken;
+        count -= taken;
+        if (filled_ == step) {
+            processBlock(out);
+        }
+    }
+}
+
+template <typename T>
+void OverlapSaveFilter<T>::finish(std::vector<T>& out) {
+    size_t history = response_->taps() - 1;
+    while (produced_ < pushed_) {
+        std::fill(input_.begin() + history + filled_, input_.end(), T(0));
+        filled_ = response_->step();
+        processBlock(out);
+    }
+    out.resize(out.size() - (produced_ - pushed_));
+    produced_ = pushed_;
+}
+
+template <typename T>
+void OverlapSaveFilter<T>::processBlock(std::vector<T>& out) {
+    const RealFftPlan<T>& plan = response_->plan();
+    const std::complex<T>* response = response_->spectrum();
+    size_t history = response_->taps() - 1;
+    size_t step = response_->step();
+    /* the zeros of the flush blocks are not counted */
+    size_t samples = std::min(step, pushed_ - counted_);
+    counted_ += samples;
+    ScopedTimer timer(STAGE_FILTER, samples);
+
+    std::copy(input_.begin(), input_.end(), block_.begin());
+    std::complex<T>* spectrum = reinterpret_cast<std::complex<T>*>(block_.data());
+    plan.forward(block_.data(), spectrum);
+    for (size_t k = 0; k < plan.spectrumSize(); ++k) {
+        spectrum[k] *= response[k];
+    }
+    plan.inverse(spectrum, block_.data());
+
+    size_t skipped = std::min(skip_, step);
+    out.insert(out.end(), block_.begin() + history + skipped, block_.begin() + history + step);
+    skip_ -= skipped;
+    produced_ += step - skipped;
+
+    std::copy(input_.end() - history, input_.end(), input_.begin());
+    filled_ = 0;
+}
+
+/* piecewise linear, constant outside the points */
+static double gainAt(const FrequencyResponse& response, double frequency) {
+    if (frequency <= response.front().first) {
+        return response.front().second;
+    }
+    for (size_t i = 1; i < response.size(); ++i) {
+        if (frequency <= response[i].first) {
+            double left = response[i - 1].first;
+            double right = response[i].first;
+            double t = right > left ? (frequency - left) / (right - left) : 1;
+            return response[i - 1].second + t * (response[i].second - response[i - 1].second);
+        }
+    }
+    return response.back().second;
+}
+
+/* The zero-phase impulse response of the sampled gain is real and even,
+ * it is shifted by half the filter to make the taps causal. */
+template <typename T>
+std::vector<T> designFir(const FrequencyResponse& response, double sample_rate, size_t taps) {
+    assert(!response.empty() && taps > 0);
+    taps |= 1;
+    size_t grid = 2;
+    while (grid < FIR_GRID_FACTOR * taps) {
+        grid <<= 1;
+    }
+
+    RealFftPlan<double> plan(grid);
+    std::vector<double> values(grid + 2);
+    std::complex<double>* spectrum = reinterpret_cast<std::complex<double>*>(values.data());
+    for (size_t k = 0; k < plan.spectrumSize(); ++k) {
+        spectrum[k] = gainAt(response, sample_rate * k / grid);
+    }
+    plan.inverse(spectrum, values.data());
+
+    std::vector<T> result(taps);
+    size_t center = (taps - 1) / 2;
+    for (size_t i = 0; i < taps; ++i) {
+        double phase = taps > 1 ? 2.0 * M_PI * i / (taps - 1) : 0;
+        double window = 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2 * phase);
+        result[i] = static_cast<T>(values[(i + grid - center) % grid] * window);
+    }
+    return result;
+}
+
+bool parseFrequencyResponse(const std::string& spec, FrequencyResponse& response) {
+    response.clear();
+    std::vector<double> numbers;
+    size_t colon = spec.find(':');
+    std::string kind = colon == std::string::npos ? "" : spec.substr(0, colon);
+    if (kind == "lowpass" || kind == "highpass" || kind == "bandpass" || kind == "bandstop") {
+        std::istringstream fields(spec.substr(colon + 1));
+        std::string field;
+        while (std::getline(fields, field, ':')) {
+            char* end = nullptr;
+            numbers.push_back(std::strtod(field.c_str(), &end));
+            if (field.empty() || *end != '\0' || numbers.back() < 0) {
+                return false;
+            }
+        }
+        /* the edge is in the middle of the transition band */
+        double half = FIR_TRANSITION / 2;
+        if ((kind == "lowpass" || kind == "highpass") && numbers.size() == 1) {
+            double pass = kind == "lowpass" ? 1 : 0;
+            response = {{numbers[0] - half, pass}, {numbers[0] + half, 1 - pass}};
+            return true;
+        }
+        if ((kind == "bandpass" || kind == "bandstop") && numbers.size() == 2 && numbers[0] < numbers[1]) {
+            double pass = kind == "bandpass" ? 1 : 0;
+            response = {
+                {numbers[0] - half, 1 - pass},
+                {numbers[0] + half, pass},
+                {numbers[1] - half, pass},
+                {numbers[1] + half, 1 - pass}
+            };
+            return true;
+        }
+        return false;
+    }
+
+    std::istringstream points(spec);
+    std::string point;
+    while (std::getline(points, point, ',')) {
+        char* end = nullptr;
+        double frequency = std::strtod(point.c_str(), &end);
+        if (end == point.c_str() || *end != ':') {
+            return false;
+        }
+        const char* gain_text = end + 1;
+        double gain = std::strtod(gain_text, &end);
+        if (end == gain_text || *end != '\0') {
+            return false;
+        }
+        if (!response.empty() && frequency < response.back().first) {
+            return false;
+        }
+        response.emplace_back(frequency, gain);
+    }
+    return !response.empty();
+}
+
+bool readFirTaps(const std::string& path, std::vector<double>& taps) {
+    std::ifstream in(path);
+    if (!in) {
+        perror("Failed open file");
+        return false;
+    }
+    double tap;
+    while (in >> tap) {
+        taps.push_back(tap);
+    }
+    if (!in.eof() || taps.empty()) {
+        errno = EINVAL;
+        perror("Failed read taps");
+        return false;
+    }
+    return true;
+}
+
+template class FirResponse<float>;
+template class FirResponse<double>;
+
+template class OverlapSaveFilter<float>;
+template class OverlapSaveFilter<double>;
+
+template std::vector<float> designFir(const FrequencyResponse& response, double sample_rate, size_t taps);
+template std::vector<double> designFir(const FrequencyResponse& response, double sample_rate, size_t taps);
@@ -0,0 +1,87 @@
+#include <cassert>
+#include <cmath>
+
+#include "mdct.h"
+
+template <typename T>
+MdctPlan<T>::MdctPlan(size_t hop) :
+    hop_(hop),
+    plan_(hop / 2),
+    window_(2 * hop),
+    pre_twiddles_(hop / 2),
+    post_twiddles_(hop / 2),
+    folded_(hop),
+    buffer_(hop / 2) {
+
+    assert(hop >= 2 && hop % 2 == 0);
+    for (size_t i = 0; i < 2 * hop; ++i) {
+        window_[i] = std::sin(M_PI * (i + 0.5) / (2 * hop));
+    }
+    /* the reversed FFT divides by hop / 2, the scale takes it back */
+    double scale = hop / 2 * std::sqrt(2.0 / hop);
+    for (size_t i = 0; i < hop / 2; ++i) {
+        pre_twiddles_[i] = std::polar(T(1), T(-M_PI * i / hop));
+        post_twiddles_[i] = std::polar(T(scale), T(-M_PI * (4 * i + 1) / (4.0 * hop)));
+    }
+}
+
+template <typename T>
+size_t MdctPlan<T>::hop() const {
+    return hop_;
+}
+
+/* X[k] = sum v[n] cos(pi (2n + 1)(2k + 1) / (4 hop)). Pairing v[2n] with
+ * v[hop - 1 - 2n] gives X[2k] and -X[hop - 1 - 2k] as the real and imaginary
+ * parts of one complex sum, which is a DFT of size hop / 2 between twiddles. */
+template <typename T>
+void MdctPlan<T>::dct4() {
+    size_t half = hop_ / 2;
+    for (size_t n = 0; n < half; ++n) {
+        buffer_[n] = std::complex<T>(folded_[2 * n], folded_[hop_ - 1 - 2 * n]) * pre_twiddles_[n];
+    }
+    plan_.transform(buffer_.data(), true);
+    for (size_t k = 0; k < half; ++k) {
+        std::complex<T> value = buffer_[k] * post_twiddles_[k];
+        folded_[2 * k] = value.real();
+        folded_[hop_ - 1 - 2 * k] = -value.imag();
+    }
+}
+
+/* with the windowed frame split into quarters (a, b, c, d) the MDCT is
+ * the DCT-IV of (-c_r - d, a - b_r), _r meaning reversed */
+template <typename T>
+void MdctPlan<T>::forward(const T* samples, T* coefficients) {
+    size_t half = hop_ / 2;
+    const T* w = window_.data();
+    for (size_t n = 0; n < half; ++n) {
+        T a = samples[n] * w[n];
+        T b_r = samples[hop_ - 1 - n] * w[hop_ - 1 - n];
+        T c_r = samples[3 * half - 1 - n] * w[3 * half - 1 - n];
+        T d = samples[3 * half + n] * w[3 * half + n];
+        folded_[n] = -c_r - d;
+        folded_[half + n] = a - b_r;
+    }
+    dct4();
+    std::copy(folded_.begin(), folded_.end(), coefficients);
+}
+
+/* the DCT-IV is its own inverse, its output (u1, u2) unfolds
+ * into (u2, -u2_r, -u1_r, -u1) */
+template <typename T>
+void MdctPlan<T>::inverse(const T* coefficients, T* samples) {
+    size_t half = hop_ / 2;
+    std::copy(coefficients, coefficients + hop_, folded_.begin());
+    dct4();
+    const T* u1 = folded_.data();
+    const T* u2 = folded_.data() + half;
+    const T* w = window_.data();
+    for (size_t n = 0; n < half; ++n) {
+        samples[n] = u2[n] * w[n];
+        samples[half + n] = -u2[half - 1 - n] * w[half + n];
+        samples[hop_ + n] = -u1[half - 1 - n] * w[hop_ + n];
+        samples[3 * half + n] = -u1[n] * w[3 * half + n];
+    }
+}
+
+template class MdctPlan<float>;
+template class MdctPlan<double>;
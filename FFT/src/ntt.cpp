@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cassert>
+
+#include "fft.h"
+#include "ntt.h"
+#include "thread_pool.h"
+
+/* below this length of the shorter input the schoolbook product is faster */
+const size_t NTT_DIRECT_SIZE = 32;
+
+static uint32_t powerModulo(uint64_t base, uint64_t exponent, uint32_t modulus) {
+    uint64_t result = 1;
+    base %= modulus;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result = result * base % modulus;
+        }
+        base = base * base % modulus;
+        exponent >>= 1;
+    }
+    return static_cast<uint32_t>(result);
+}
+
+NttPlan::NttPlan(uint32_t modulus, uint32_t root, size_t n) : arithmetic_(modulus), n_(n) {
+    assert(n > 0 && (n & (n - 1)) == 0 && (modulus - 1) % n == 0);
+
+    size_t log_n = 0;
+    while ((size_t(1) << log_n) < n_) {
+        ++log_n;
+    }
+    permutation_.resize(n_);
+    for (size_t i = 0; i < n_; ++i) {
+        size_t rev = 0;
+        for (size_t bit = 0; bit < log_n; ++bit) {
+            rev |= ((i >> bit) & 1) << (log_n - bit - 1);
+        }
+        permutation_[i] = rev;
+    }
+
+    twiddles_.resize(n_);
+    inverse_twiddles_.resize(n_);
+    for (size_t half = 1; half < n_; half <<= 1) {
+        uint32_t w = powerModulo(root, (modulus - 1) / (2 * half), modulus);
+        uint32_t w_inverse = powerModulo(w, modulus - 2, modulus);
+        uint64_t power = 1;
+        uint64_t power_inverse = 1;
+        for (size_t j = 0; j < half; ++j) {
+            twiddles_[half + j] = arithmetic_.toForm(static_cast<uint32_t>(power));
+            inverse_twiddles_[half + j] = arithmetic_.toForm(static_cast<uint32_t>(power_inverse));
+            power = power * w % modulus;
+            power_inverse = power_inverse * w_inverse % modulus;
+        }
+    }
+    scale_ = arithmetic_.toForm(powerModulo(n_, modulus - 2, modulus));
+}
+
+size_t NttPlan::size() const {
+    return n_;
+}
+
+uint32_t NttPlan::modulus() const {
+    return arithmetic_.modulus;
+}
+
+void NttPlan::forward(uint32_t* data) const {
+    run(data, twiddles_);
+}
+
+void NttPlan::inverse(uint32_t* data) const {
+    run(data, inverse_twiddles_);
+    for (size_t i = 0; i < n_; ++i) {
+        data[i] = arithmetic_.multiply(data[i], scale_);
+    }
+}
+
+/* Values stay in the ordinary form: a twiddle in Montgomery form times
+ * a plain value gives the plain product. */
+void NttPlan::run(uint32_t* data, const std::vector<uint32_t>& twiddles) const {
+    for (size_t i = 0; i < n_; ++i) {
+        if (i < permutation_[i]) {
+            std::swap(data[i], data[permutation_[i]]);
+        }
+    }
+    uint32_t p = arithmetic_.modulus;
+    for (size_t half = 1; half < n_; half <<= 1) {
+        const uint32_t* w = twiddles.data() + half;
+        for (size_t start = 0; start < n_; start += 2 * half) {
+            uint32_t* a = data + start;
+            uint32_t* b = a + half;
+            for (size_t j = 0; j < half; ++j) {
+                uint32_t t = arithmetic_.multiply(b[j], w[j]);
+                uint32_t x = a[j];
+                a[j] = x + t >= p ? x + t - p : x + t;
+                b[j] = x >= t ? x - t : x + p - t;
+            }
+        }
+    }
+}
+
+/* both inputs are reduced and transformed, their product goes back */
+static std::vector<uint32_t> convolveWithPlan(
+    const NttPlan& plan,
+    const std::vector<uint64_t>& a,
+    const std::vector<uint64_t>& b,
+    size_t length
+) {
+    Barrett barrett(plan.modulus());
+    Montgomery arithmetic(plan.modulus());
+    std::vector<uint32_t> fa(plan.size(), 0);
+    std::vector<uint32_t> fb(plan.size(), 0);
+    for (size_t i = 0; i < a.size(); ++i) {
+        fa[i] = static_cast<uint32_t>(barrett.reduce(a[i]));
+    }
+    for (size_t i = 0; i < b.size(); ++i) {
+        fb[i] = static_cast<uint32_t>(barrett.reduce(b[i]));
+    }
+    plan.forward(fa.data());
+    plan.forward(fb.data());
+    /* fa * (fb in the form) is the plain product */
+    for (size_t i = 0; i < plan.size(); ++i) {
+        fa[i] = arithmetic.multiply(fa[i], arithmetic.toForm(fb[i]));
+    }
+    plan.inverse(fa.data());
+    fa.resize(length);
+    return fa;
+}
+
+static size_t transformSize(size_t length) {
+    size_t n = 1;
+    while (n < length) {
+        n <<= 1;
+    }
+    assert(n <= NTT_MAX_SIZE);
+    return n;
+}
+
+std::vector<uint32_t> convolveModulo(
+    const std::vector<uint32_t>& a,
+    const std::vector<uint32_t>& b,
+    size_t prime
+) {
+    assert(prime < 3);
+    if (a.empty() || b.empty()) {
+        return {};
+    }
+    size_t length = a.size() + b.size() - 1;
+    NttPlan plan(NTT_PRIMES[prime], NTT_ROOTS[prime], transformSize(length));
+    return convolveWithPlan(
+        plan,
+        std::vector<uint64_t>(a.begin(), a.end()),
+        std::vector<uint64_t>(b.begin(), b.end()),
+        length
+    );
+}
+
+/* Garner's form of the CRT: x = r0 + p0 * (y1 + p1 * y2) with
+ * y1 = (r1 - r0) / p0 mod p1 and y2 = ((r2 - r0) / p0 - y1) / p1 mod p2. */
+static uint64_t recombine(uint32_t r0, uint32_t r1, uint32_t r2) {
+    const uint64_t p0 = NTT_PRIMES[0];
+    const uint64_t p1 = NTT_PRIMES[1];
+    const uint64_t p2 = NTT_PRIMES[2];
+    static const uint64_t p0_inverse_1 = powerModulo(p0, p1 - 2, p1);
+    static const uint64_t p0_inverse_2 = powerModulo(p0, p2 - 2, p2);
+    static const uint64_t p1_inverse_2 = powerModulo(p1, p2 - 2, p2);
+
+    uint64_t y1 = (r1 + p1 - r0 % p1) % p1 * p0_inverse_1 % p1;
+    uint64_t y2 = (r2 + p2 - r0 % p2) % p2 * p0_inverse_2 % p2;
+    y2 = (y2 + p2 - y1 % p2) % p2 * p1_inverse_2 % p2;
+    /* unsigned arithmetic wraps modulo 2^64, which is what is returned */
+    return r0 + p0 * (y1 + p1 * y2);
+}
+
+std::vector<uint64_t> convolve(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    if (a.empty() || b.empty()) {
+        return {};
+    }
+    size_t length = a.size() + b.size() - 1;
+    std::vector<uint64_t> result(length, 0);
+
+    if (std::min(a.size(), b.size()) <= NTT_DIRECT_SIZE) {
+        for (size_t i = 0; i < a.size(); ++i) {
+            for (size_t j = 0; j < b.size(); ++j) {
+                result[i + j] += a[i] * b[j];
+            }
+        }
+        return result;
+    }
+
+    size_t n = transformSize(length);
+    std::vector<uint32_t> residues[3];
+    fftThreadPool().parallelFor(3, [&](size_t begin, size_t end) {
+        for (size_t prime = begin; prime < end; ++prime) {
+            NttPlan plan(NTT_PRIMES[prime], NTT_ROOTS[prime], n);
+            residues[prime] = convolveWithPlan(plan, a, b, length);
+        }
+    });
+    for (size_t k = 0; k < length; ++k) {
+        result[k] = recombine(residues[0][k], residues[1][k], residues[2][k]);
+    }
+    return result;
+}
+
+/* Limbs are split into 16-bit halves, so a coefficient of the product is
+ * below 2^32 times the length and the carries fit in 64 bits. */
+std::vector<uint32_t> multiplyBig(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    auto split = [](const std::vector<uint32_t>& limbs) {
+        std::vector<uint64_t> halves(2 * limbs.size());
+        for (size_t i = 0; i < limbs.size(); ++i) {
+            halves[2 * i] = limbs[i] & 0xFFFF;
+            halves[2 * i + 1] = limbs[i] >> 16;
+        }
+        return halves;
+    };
+    std::vector<uint64_t> product = convolve(split(a), split(b));
+
+    std::vector<uint32_t> result((product.size() + 1) / 2 + 1, 0);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < 2 * result.size(); ++i) {
+        carry += i < product.size() ? product[i] : 0;
+        result[i / 2] |= static_cast<uint32_t>(carry & 0xFFFF) << (16 * (i % 2));
+        carry >>= 16;
+    }
+    while (!result.empty() && result.back() == 0) {
+        result.pop_back();
+    }
+    return result;
+}
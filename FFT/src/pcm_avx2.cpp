@@ -0,0 +1,14 @@
+#include "pcm_kernels.h"
+
+/* built with -mavx2, selected at runtime by CPUID */
+template <>
+const PcmKernels<float>& avx2PcmKernels<float>() {
+    static const PcmKernels<float> kernels = makePcmKernels<float, Avx2Isa>("avx2");
+    return kernels;
+}
+
+template <>
+const PcmKernels<double>& avx2PcmKernels<double>() {
+    static const PcmKernels<double> kernels = makePcmKernels<double, Avx2Isa>("avx2");
+    return kernels;
+}
@@ -0,0 +1,75 @@
+#include <sys/resource.h>
+
+#include <iomanip>
+
+#include "stats.h"
+
+struct StageCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nanoseconds{0};
+    std::atomic<uint64_t> samples{0};
+};
+
+static StageCounters counters[STAGE_COUNT];
+
+static const char* STAGE_NAMES[STAGE_COUNT] = {
+    "open",
+    "decode",
+    "filter",
+    "forward",
+    "select",
+    "inverse",
+    "encode",
+    "create"
+};
+
+void setStatsEnabled(bool enabled) {
+    statsEnabledFlag().store(enabled, std::memory_order_relaxed);
+}
+
+void addStageTime(Stage stage, uint64_t nanoseconds, uint64_t samples) {
+    counters[stage].calls.fetch_add(1, std::memory_order_relaxed);
+    counters[stage].nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    counters[stage].samples.fetch_add(samples, std::memory_order_relaxed);
+}
+
+void printStats(std::ostream& out, bool json, double wall_seconds) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double peak_mb = usage.ru_maxrss / 1024.0;
+
+    if (json) {
+        out << "{\"stages\": [";
+    } else {
+        out << std::left << std::setw(10) << "stage" << std::right
+            << std::setw(8) << "calls" << std::setw(12) << "seconds"
+            << std::setw(12) << "Msamples" << std::setw(12) << "Msamples/s" << "\n";
+    }
+    bool first = true;
+    for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+        uint64_t calls = counters[stage].calls.load();
+        if (calls == 0) {
+            continue;
+        }
+        double seconds = counters[stage].nanoseconds.load() * 1e-9;
+        double msamples = counters[stage].samples.load() / 1e6;
+        double rate = seconds > 0 ? msamples / seconds : 0;
+        if (json) {
+            out << (first ? "" : ", ") << "{\"stage\": \"" << STAGE_NAMES[stage] << "\""
+                << ", \"calls\": " << calls << ", \"seconds\": " << seconds
+                << ", \"msamples\": " << msamples << ", \"msamples_per_s\": " << rate << "}";
+        } else {
+            out << std::left << std::setw(10) << STAGE_NAMES[stage] << std::right << std::fixed
+                << std::setw(8) << calls << std::setw(12) << std::setprecision(4) << seconds
+                << std::setw(12) << std::setprecision(2) << msamples
+                << std::setw(12) << std::setprecision(1) << rate << "\n";
+        }
+        first = false;
+    }
+    if (json) {
+        out << "], \"wall_seconds\": " << wall_seconds << ", \"peak_rss_mb\": " << peak_mb << "}" << std::endl;
+    } else {
+        out << std::fixed << std::setprecision(4) << "wall " << wall_seconds << " s, peak RSS "
+            << std::setprecision(1) << peak_mb << " MB" << std::endl;
+    }
+}
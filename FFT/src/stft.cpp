@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "stats.h"
+#include "stft.h"
+
+template <typename T>
+StftCompressor<T>::StftCompressor(size_t frame_size, char percents) :
+    StftCompressor(std::make_shared<const RealFftPlan<T>>(frame_size), percents) {
+}
+
+template <typename T>
+StftCompressor<T>::StftCompressor(std::shared_ptr<const RealFftPlan<T>> plan, char percents) :
+    frame_size_(plan->size()),
+    hop_(plan->size() / 2),
+    percents_(percents),
+    plan_(std::move(plan)),
+    window_(frame_size_),
+    input_(frame_size_, T(0)),
+    filled_(hop_),
+    overlap_(hop_, T(0)),
+    frame_(frame_size_ + 2),
+    skip_(hop_),
+    pushed_(0),
+    produced_(0),
+    counted_(0) {
+
+    assert(frame_size_ >= 2 && frame_size_ % 2 == 0);
+    for (size_t i = 0; i < frame_size_; ++i) {
+        window_[i] = std::sin(M_PI * i / frame_size_);
+    }
+}
+
+template <typename T>
+size_t StftCompressor<T>::frameSize() const {
+    return frame_size_;
+}
+
+template <typename T>
+void StftCompressor<T>::push(const T* samples, size_t count, std::vector<T>& out) {
+    pushed_ += count;
+    while (count > 0) {
+        size_t taken = std::min(count, frame_size_ - filled_);
+        std::copy(samples, samples + taken, input_.begin() + filled_);
+        filled_ += taken;
+        samples += taken;
+        count -= taken;
+        if (filled_ == frame_size_) {
+            processFrame(out);
+        }
+    }
+}
+
+template <typename T>
+void StftCompressor<T>::finish(std::vector<T>& out) {
+    while (produced_ < pushed_) {
+        std::fill(input_.begin() + filled_, input_.end(), T(0));
+        filled_ = frame_size_;
+        processFrame(out);
+    }
+    out.resize(out.size() - (produced_ - pushed_));
+    produced_ = pushed_;
+}
+
+template <typename T>
+void StftCompressor<T>::processFrame(std::vector<T>& out) {
+    for (size_t i = 0; i < frame_size_; ++i) {
+        frame_[i] = input_[i] * window_[i];
+    }
+
+    /* frames overlap, each one moves the input on by a hop of which only
+     * the pushed samples count, not the zeros of the flush */
+    size_t samples = std::min(hop_, pushed_ - counted_);
+    counted_ += samples;
+    std::complex<T>* spectrum = reinterpret_cast<std::complex<T>*>(frame_.data());
+    {
+        ScopedTimer timer(STAGE_FORWARD, samples);
+        plan_->forward(frame_.data(), spectrum);
+    }
+    {
+        ScopedTimer timer(STAGE_SELECT, samples);
+        keepLargest(spectrum, plan_->spectrumSize(), percents_);
+    }
+    {
+        ScopedTimer timer(STAGE_INVERSE, samples);
+        plan_->inverse(spectrum, frame_.data());
+    }
+
+    size_t emitted = hop_ - std::min(skip_, hop_);
+    for (size_t i = skip_; i < hop_; ++i) {
+        out.push_back(overlap_[i] + frame_[i] * window_[i]);
+    }
+    skip_ = 0;
+    produced_ += emitted;
+    for (size_t i = 0; i < hop_; ++i) {
+        overlap_[i] = frame_[hop_ + i] * window_[hop_ + i];
+    }
+
+    std::copy(input_.begin() + hop_, input_.end(), input_.begin());
+    filled_ = hop_;
+}
+
+template class StftCompressor<float>;
+template class StftCompressor<double>;
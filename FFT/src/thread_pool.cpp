@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) : stopping_(false) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers_.size() + 1;
+}
+
+bool ThreadPool::runOneTask(std::unique_lock<std::mutex>& lock) {
+    if (tasks_.empty()) {
+        return false;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop();
+    lock.unlock();
+    task();
+    lock.lock();
+    return true;
+}
+
+void ThreadPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (stopping_ && tasks_.empty()) {
+            return;
+        }
+        runOneTask(lock);
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    size_t chunks = std::min(count, size());
+    if (chunks == 1) {
+        body(0, count);
+        return;
+    }
+
+    size_t remaining = chunks;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        size_t begin = count * chunk / chunks;
+        size_t end = count * (chunk + 1) / chunks;
+        tasks_.push([this, &body, &remaining, begin, end] {
+            body(begin, end);
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (--remaining == 0) {
+                wake_.notify_all();
+            }
+        });
+    }
+    wake_.notify_all();
+
+    while (remaining > 0) {
+        if (!runOneTask(lock)) {
+            wake_.wait(lock, [this, &remaining] { return remaining == 0 || !tasks_.empty(); });
+        }
+    }
+}
@@ -1,7 +1,187 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcm_kernels.h"
+#include "stats.h"
 #include "wav.h"
 
-void getWavHeader(FILE *file, WAVHEADER* header) {
-    fread(header, sizeof(WAVHEADER), 1, file);
+// Шум для dither генерируется блоками такого размера.
+const size_t DITHER_BLOCK = 4096;
+
+template <>
+const PcmKernels<float>& scalarPcmKernels<float>() {
+    static const PcmKernels<float> kernels = makePcmKernels<float, ScalarIsa>("scalar");
+    return kernels;
+}
+
+template <>
+const PcmKernels<double>& scalarPcmKernels<double>() {
+    static const PcmKernels<double> kernels = makePcmKernels<double, ScalarIsa>("scalar");
+    return kernels;
+}
+
+// Преобразование упирается в память, так что достаточно AVX2.
+template <typename T>
+static const PcmKernels<T>* detectPcmKernels() {
+#ifdef WAV_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2PcmKernels<T>();
+    }
+#endif
+    return &scalarPcmKernels<T>();
+}
+
+template <typename T>
+static const PcmKernels<T>& pcmKernels() {
+    static const PcmKernels<T>* kernels = detectPcmKernels<T>();
+    return *kernels;
+}
+
+// Треугольный шум в диапазоне (-1, 1): разность двух равномерных величин.
+template <typename T>
+static void fillDither(T* noise, size_t count) {
+    thread_local uint64_t state = 0x9e3779b97f4a7c15ULL;
+    const T scale = T(1) / T(1ULL << 32);
+    for (size_t i = 0; i < count; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        T a = T(uint32_t(state)) * scale;
+        T b = T(uint32_t(state >> 32)) * scale;
+        noise[i] = a - b;
+    }
+}
+
+// Коды форматов из заголовка "fmt ".
+const unsigned short WAVE_FORMAT_PCM = 1;
+const unsigned short WAVE_FORMAT_IEEE_FLOAT = 3;
+const unsigned short WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// Размер "data" в RF64 и в файлах, где он не известен заранее.
+const uint32_t RIFF_SIZE_UNKNOWN = 0xFFFFFFFF;
+
+// "fmt " для PCM, и для WAVE_FORMAT_EXTENSIBLE, где после cbSize, validBitsPerSample
+// и channelMask в начале GUID подформата лежит настоящий код формата.
+const size_t FMT_PCM_SIZE = 16;
+const size_t FMT_EXTENSIBLE_SIZE = 40;
+const size_t FMT_SUBFORMAT_OFFSET = 24;
+
+static bool sameId(const char* id, const char* expected) {
+    return std::memcmp(id, expected, 4) == 0;
+}
+
+RiffChunkIterator::RiffChunkIterator(RiffReader reader, uint64_t file_size)
+    : reader_(std::move(reader)), file_size_(file_size), position_(12), valid_(false), rf64_(false),
+      data_size64_(0) {
+    char riff[12];
+    if (!reader_(0, riff, sizeof(riff))) {
+        return;
+    }
+    rf64_ = sameId(riff, "RF64");
+    valid_ = (sameId(riff, "RIFF") || rf64_) && sameId(riff + 8, "WAVE");
+}
+
+bool RiffChunkIterator::valid() const {
+    return valid_;
+}
+
+bool RiffChunkIterator::next(RiffChunk& chunk) {
+    char head[8];
+    if (!valid_ || position_ + sizeof(head) > file_size_ || !reader_(position_, head, sizeof(head))) {
+        return false;
+    }
+    uint32_t size;
+    std::memcpy(chunk.id, head, 4);
+    std::memcpy(&size, head + 4, 4);
+    chunk.size = size;
+    chunk.offset = position_ + sizeof(head);
+
+    if (rf64_ && sameId(chunk.id, "ds64")) {
+        // размер всего RIFF, размер data, число кадров, дальше таблица остальных размеров
+        uint64_t sizes[2];
+        if (size >= sizeof(sizes) && reader_(chunk.offset, sizes, sizeof(sizes))) {
+            data_size64_ = sizes[1];
+        }
+    }
+    if (rf64_ && sameId(chunk.id, "data") && size == RIFF_SIZE_UNKNOWN) {
+        chunk.size = data_size64_;
+    }
+    // содержимое выравнивается на чётную границу
+    position_ = chunk.offset + chunk.size + (chunk.size & 1);
+    return true;
+}
+
+bool readWavLayout(const RiffReader& reader, uint64_t file_size, WAVHEADER* header, RiffChunk* data) {
+    RiffChunkIterator chunks(reader, file_size);
+    if (!chunks.valid()) {
+        return false;
+    }
+    bool has_format = false;
+    bool has_data = false;
+    RiffChunk chunk;
+    while (chunks.next(chunk)) {
+        if (sameId(chunk.id, "fmt ")) {
+            char fmt[FMT_EXTENSIBLE_SIZE];
+            size_t size = std::min<uint64_t>(chunk.size, sizeof(fmt));
+            if (size < FMT_PCM_SIZE || !reader(chunk.offset, fmt, size)) {
+                return false;
+            }
+            std::memcpy(&header->audioFormat, fmt, FMT_PCM_SIZE);
+            if (header->audioFormat == WAVE_FORMAT_EXTENSIBLE && size == FMT_EXTENSIBLE_SIZE) {
+                std::memcpy(&header->audioFormat, fmt + FMT_SUBFORMAT_OFFSET, sizeof(header->audioFormat));
+            }
+            has_format = true;
+        } else if (sameId(chunk.id, "data")) {
+            // обрезанный файл: берём только то, что реально записано
+            chunk.size = std::min(chunk.size, file_size - chunk.offset);
+            *data = chunk;
+            has_data = true;
+            break;
+        }
+    }
+    if (!has_format || !has_data) {
+        return false;
+    }
+    // кадр короче своих сэмплов увёл бы чтение и запись за конец данных
+    if (header->numChannels == 0 || header->bitsPerSample == 0 ||
+        header->blockAlign != header->numChannels * ((header->bitsPerSample + 7) / 8)) {
+        return false;
+    }
+
+    std::memcpy(header->chunkId, "RIFF", 4);
+    std::memcpy(header->format, "WAVE", 4);
+    std::memcpy(header->subchunk1Id, "fmt ", 4);
+    std::memcpy(header->subchunk2Id, "data", 4);
+    header->subchunk1Size = FMT_PCM_SIZE;
+    header->subchunk2Size = std::min<uint64_t>(data->size, RIFF_SIZE_UNKNOWN);
+    header->chunkSize = std::min<uint64_t>(36 + data->size, RIFF_SIZE_UNKNOWN);
+    return true;
+}
+
+bool getWavHeader(FILE *file, WAVHEADER* header, uint64_t* data_size) {
+    if (fseeko(file, 0, SEEK_END) != 0) {
+        return false;
+    }
+    uint64_t file_size = ftello(file);
+    RiffReader reader = [file](uint64_t offset, void* buffer, size_t size) {
+        return fseeko(file, offset, SEEK_SET) == 0 && fread(buffer, size, 1, file) == 1;
+    };
+    RiffChunk data;
+    if (!readWavLayout(reader, file_size, header, &data)) {
+        return false;
+    }
+    if (data_size) {
+        *data_size = data.size;
+    }
+    return fseeko(file, data.offset, SEEK_SET) == 0;
 }
 
 void printWavData(WAVHEADER* header) {
@@ -44,3 +224,298 @@ void saveNewWav(std::string result, WAVHEADER* header, std::vector<std::complex<
     delete[] new_data;
 
 }
+
+SampleFormat sampleFormat(const WAVHEADER* header) {
+    if (header->audioFormat == WAVE_FORMAT_IEEE_FLOAT && header->bitsPerSample == 32) {
+        return SAMPLE_FLOAT32;
+    }
+    if (header->audioFormat != WAVE_FORMAT_PCM) {
+        return SAMPLE_UNSUPPORTED;
+    }
+    switch (header->bitsPerSample) {
+        case 8:
+            return SAMPLE_UINT8;
+        case 16:
+            return SAMPLE_INT16;
+        case 24:
+            return SAMPLE_INT24;
+        case 32:
+            return SAMPLE_INT32;
+        default:
+            return SAMPLE_UNSUPPORTED;
+    }
+}
+
+template <typename T>
+void decodeChannel(const char* data, size_t frames, const WAVHEADER* header, size_t channel, T* samples) {
+    SampleFormat format = sampleFormat(header);
+    assert(format != SAMPLE_UNSUPPORTED);
+    size_t sample_bytes = header->bitsPerSample / 8;
+    ScopedTimer timer(STAGE_DECODE, frames);
+    pcmKernels<T>().decode[format](data + channel * sample_bytes, header->blockAlign, frames, samples);
+}
+
+template <typename T>
+void decodeChannels(const char* data, size_t frames, const WAVHEADER* header, std::vector<std::vector<T>>& channels) {
+    channels.resize(header->numChannels);
+    for (size_t c = 0; c < channels.size(); ++c) {
+        channels[c].resize(frames);
+        decodeChannel(data, frames, header, c, channels[c].data());
+    }
+}
+
+template <typename T>
+void encodeChannel(const T* samples, size_t frames, const WAVHEADER* header, size_t channel, char* data, bool dither) {
+    SampleFormat format = sampleFormat(header);
+    assert(format != SAMPLE_UNSUPPORTED);
+    const auto encode = pcmKernels<T>().encode[format];
+    size_t sample_bytes = header->bitsPerSample / 8;
+    ScopedTimer timer(STAGE_ENCODE, frames);
+    char* out = data + channel * sample_bytes;
+    // у float-сэмплов нет младшего разряда, шум им не нужен
+    if (!dither || format == SAMPLE_FLOAT32) {
+        encode(samples, nullptr, frames, out, header->blockAlign);
+        return;
+    }
+    std::vector<T> noise(DITHER_BLOCK);
+    for (size_t start = 0; start < frames; start += DITHER_BLOCK) {
+        size_t count = std::min(DITHER_BLOCK, frames - start);
+        fillDither(noise.data(), count);
+        encode(samples + start, noise.data(), count, out + start * header->blockAlign, header->blockAlign);
+    }
+}
+
+template <typename T>
+void encodeChannels(const std::vector<std::vector<T>>& channels, const WAVHEADER* header, char* data, bool dither) {
+    for (size_t c = 0; c < channels.size(); ++c) {
+        encodeChannel(channels[c].data(), channels[c].size(), header, c, data, dither);
+    }
+}
+
+template <typename T>
+void saveNewWav(std::string result, WAVHEADER* header, const std::vector<std::vector<T>>& channels, bool dither) {
+
+    size_t frames = channels.empty() ? 0 : channels[0].size();
+    WAVHEADER new_header = *header;
+    new_header.subchunk2Size = frames * header->blockAlign;
+    new_header.chunkSize = 36 + new_header.subchunk2Size;
+
+    std::vector<char> new_data(new_header.subchunk2Size);
+    encodeChannels(channels, header, new_data.data(), dither);
+
+    FILE* result_file = fopen(result.c_str(), "wb");
+    if (!result_file) {
+        perror("Failed open file");
+        return;
+    }
+    fwrite(&new_header, sizeof(new_header), 1, result_file);
+    fwrite(new_data.data(), 1, new_data.size(), result_file);
+    fclose(result_file);
+
+}
+
+WavFile::~WavFile() {
+    close();
+}
+
+bool WavFile::map(int fd, size_t size, bool writable) {
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* mapping = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Failed map file");
+        return false;
+    }
+    // файл читается и пишется от начала к концу
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    mapping_ = static_cast<char*>(mapping);
+    mapping_size_ = size;
+    return true;
+}
+
+bool WavFile::open(const std::string& path) {
+    close();
+    ScopedTimer timer(STAGE_OPEN);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("Failed open file");
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror("Failed open file");
+        ::close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+    if (size == 0) {
+        errno = EINVAL;
+        perror("Failed read wav header");
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, size, false)) {
+        return false;
+    }
+    // подцепочки читаются прямо из отображения, их содержимое не трогается
+    RiffReader reader = [this](uint64_t offset, void* buffer, size_t count) {
+        if (offset + count > mapping_size_) {
+            return false;
+        }
+        std::memcpy(buffer, mapping_ + offset, count);
+        return true;
+    };
+    RiffChunk data;
+    if (!readWavLayout(reader, size, &header_, &data)) {
+        close();
+        errno = EINVAL;
+        perror("Failed read wav header");
+        return false;
+    }
+    data_offset_ = data.offset;
+    data_size_ = data.size;
+    timer.setSamples(frames() * header_.numChannels);
+    return true;
+}
+
+bool WavFile::create(const std::string& path, const WAVHEADER& header, size_t data_size) {
+    close();
+    ScopedTimer timer(STAGE_CREATE, header.blockAlign ? data_size / header.blockAlign * header.numChannels : 0);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed open file");
+        return false;
+    }
+    // канонический заголовок из 44 байт, а для больших данных RF64:
+    // "RF64", "WAVE", ds64 с 64-битными размерами, "fmt " и "data"
+    bool rf64 = data_size > RIFF_SIZE_UNKNOWN - 36;
+    std::vector<char> layout;
+    auto put = [&layout](const void* bytes, size_t count) {
+        const char* p = static_cast<const char*>(bytes);
+        layout.insert(layout.end(), p, p + count);
+    };
+    uint32_t unknown = RIFF_SIZE_UNKNOWN;
+    uint32_t fmt_size = FMT_PCM_SIZE;
+    uint32_t riff_size = rf64 ? unknown : 36 + data_size;
+    uint32_t data_size32 = rf64 ? unknown : data_size;
+    put(rf64 ? "RF64" : "RIFF", 4);
+    put(&riff_size, 4);
+    put("WAVE", 4);
+    if (rf64) {
+        const size_t ds64_size = 28;
+        uint64_t ds64[3] = {4 + (8 + ds64_size) + (8 + FMT_PCM_SIZE) + 8 + data_size, data_size,
+                            header.blockAlign ? data_size / header.blockAlign : 0};
+        uint32_t table_length = 0;
+        uint32_t chunk_size = ds64_size;
+        put("ds64", 4);
+        put(&chunk_size, 4);
+        put(ds64, sizeof(ds64));
+        put(&table_length, 4);
+    }
+    put("fmt ", 4);
+    put(&fmt_size, 4);
+    put(&header.audioFormat, FMT_PCM_SIZE);
+    put("data", 4);
+    put(&data_size32, 4);
+
+    size_t size = layout.size() + data_size;
+    // место выделяется сразу, иначе нехватка диска проявится как SIGBUS при записи
+    int error = posix_fallocate(fd, 0, size);
+    if (error != 0) {
+        errno = error;
+        perror("Failed allocate file");
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, size, true)) {
+        return false;
+    }
+    std::memcpy(mapping_, layout.data(), layout.size());
+    header_ = header;
+    std::memcpy(header_.chunkId, "RIFF", 4);
+    std::memcpy(header_.format, "WAVE", 4);
+    std::memcpy(header_.subchunk1Id, "fmt ", 4);
+    std::memcpy(header_.subchunk2Id, "data", 4);
+    header_.subchunk1Size = FMT_PCM_SIZE;
+    header_.subchunk2Size = std::min<uint64_t>(data_size, RIFF_SIZE_UNKNOWN);
+    header_.chunkSize = std::min<uint64_t>(36 + data_size, RIFF_SIZE_UNKNOWN);
+    data_offset_ = layout.size();
+    data_size_ = data_size;
+    return true;
+}
+
+void WavFile::close() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+    data_offset_ = 0;
+    data_size_ = 0;
+    released_ = 0;
+}
+
+const WAVHEADER& WavFile::header() const {
+    return header_;
+}
+
+size_t WavFile::frames() const {
+    return header_.blockAlign ? data_size_ / header_.blockAlign : 0;
+}
+
+char* WavFile::data() {
+    return mapping_ + data_offset_;
+}
+
+const char* WavFile::data() const {
+    return mapping_ + data_offset_;
+}
+
+size_t WavFile::dataSize() const {
+    return data_size_;
+}
+
+void WavFile::prefetch() {
+    if (mapping_) {
+        madvise(mapping_, mapping_size_, MADV_WILLNEED);
+    }
+}
+
+void WavFile::release(size_t end) {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    // отпускаем всё от прошлой границы до последней целой страницы: если отпускать
+    // только страницы внутри каждого куска, частично покрытые большие страницы
+    // файла остаются отображёнными
+    size_t limit = std::min(data_offset_ + end, mapping_size_) / page * page;
+    if (released_ < limit) {
+        madvise(mapping_ + released_, limit - released_, MADV_DONTNEED);
+        released_ = limit;
+    }
+}
+
+void WavFile::evict() {
+    if (mapping_) {
+        madvise(mapping_, mapping_size_, MADV_DONTNEED);
+    }
+}
+
+template void decodeChannel(const char* data, size_t frames, const WAVHEADER* header, size_t channel, float* samples);
+template void decodeChannel(const char* data, size_t frames, const WAVHEADER* header, size_t channel, double* samples);
+template void encodeChannel(const float* samples, size_t frames, const WAVHEADER* header, size_t channel, char* data,
+                            bool dither);
+template void encodeChannel(const double* samples, size_t frames, const WAVHEADER* header, size_t channel, char* data,
+                            bool dither);
+template void decodeChannels(const char* data, size_t frames, const WAVHEADER* header,
+                             std::vector<std::vector<float>>& channels);
+template void decodeChannels(const char* data, size_t frames, const WAVHEADER* header,
+                             std::vector<std::vector<double>>& channels);
+
+template void encodeChannels(const std::vector<std::vector<float>>& channels, const WAVHEADER* header, char* data,
+                             bool dither);
+template void encodeChannels(const std::vector<std::vector<double>>& channels, const WAVHEADER* header, char* data,
+                             bool dither);
+
+template void saveNewWav(std::string result, WAVHEADER* header, const std::vector<std::vector<float>>& channels,
+                         bool dither);
+template void saveNewWav(std::string result, WAVHEADER* header, const std::vector<std::vector<double>>& channels,
+                         bool dither);
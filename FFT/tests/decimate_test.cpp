@@ -0,0 +1,48 @@
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "fft.h"
+
+/* decimateData against ideal decimation: a few tones below the new Nyquist
+ * frequency under a Hann envelope (so the ends need no wrap-around) have to
+ * come out as the input taken at every k-th sample, for lengths that are
+ * and are not multiples of k */
+static bool checkDecimation(size_t n, size_t k) {
+    std::vector<double> data(n);
+    for (size_t i = 0; i < n; ++i) {
+        double t = static_cast<double>(i) / n;
+        double envelope = 0.5 - 0.5 * std::cos(2 * M_PI * t);
+        data[i] = envelope * (std::sin(2 * M_PI * 0.0123 * i) + 0.5 * std::sin(2 * M_PI * 0.1417 * i + 1));
+    }
+    std::vector<double> input = data;
+
+    RealFftPlan<double> target(decimationFftSize(n, k));
+    RealFftPlan<double> plan(target.size() * k);
+    decimateData(data, plan, target, 100);
+
+    size_t m = (n + k - 1) / k;
+    if (data.size() != m) {
+        printf("n %zu k %zu: %zu samples instead of %zu\n", n, k, data.size(), m);
+        return false;
+    }
+    double signal = 0;
+    double noise = 0;
+    for (size_t j = 0; j < m; ++j) {
+        signal += input[j * k] * input[j * k];
+        noise += (data[j] - input[j * k]) * (data[j] - input[j * k]);
+    }
+    double snr = 10 * std::log10(signal / noise);
+    printf("n %zu k %zu: SNR %.1f dB\n", n, k, snr);
+    return snr > 60;
+}
+
+int main() {
+    bool ok = true;
+    for (size_t n : {100003, 100004, 4097}) {
+        for (size_t k : {2, 3}) {
+            ok = checkDecimation(n, k) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
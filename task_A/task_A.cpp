@@ -1,47 +1,326 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <string>
 
-std::vector<size_t> findPositions(
-    const std::string &pattern,
-    const std::string &text
-) {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+const char *USAGE =
+    "task_A < input (pattern and text words on stdin)\n"
+    "task_A [--threads N] pattern file";
+
+/* text is read and matched this many bytes at a time */
+const size_t TEXT_CHUNK_SIZE = 1 << 16;
+/* the parallel search gives every thread a chunk of this size per round,
+ * so memory stays bounded for files of any size */
+const size_t THREAD_CHUNK_SIZE = 8 << 20;
+/* the prefilter tests this many text positions at once */
+const size_t CANDIDATE_BLOCK = 32;
 
-    std::string s = pattern + "#" + text;
-    size_t n = s.length();
+/* z[i] = length of the longest common prefix of pattern and its suffix
+ * starting at i, z[0] = |pattern| */
+std::vector<size_t> patternZ(const std::string &pattern) {
     size_t p = pattern.length();
-    std::vector<size_t> z (p, 0);
-    std::vector<size_t> positions;
+    std::vector<size_t> z(p, 0);
+    if (p == 0) {
+        return z;
+    }
+    z[0] = p;
     size_t left = 0;
-    size_t right = 0;
+    size_t right = 0;       //[left, right) matches a prefix
 
-    for (size_t i = 1; i < n; ++i) {
+    for (size_t i = 1; i < p; ++i) {
         size_t z_val = 0;
-        if (i <= right) {
-            z_val = std::min(right - i + 1, z[i - left]);
+        if (i < right) {
+            z_val = std::min(right - i, z[i - left]);
         }
         while (
-            i + z_val < n &&
-            s[z_val] == s[i + z_val]
+            i + z_val < p &&
+            pattern[z_val] == pattern[i + z_val]
         ) {
             ++z_val;
         }
-        if (i + z_val - 1 > right) {
+        if (i + z_val > right) {
             left = i;
-            right = i + z_val - 1;
+            right = i + z_val;
+        }
+        z[i] = z_val;
+    }
+
+    return z;
+}
+
+/* The pattern with its Z-array, built once and shared read-only by every
+ * matcher, including the threads of the parallel search. */
+struct PatternIndex {
+    explicit PatternIndex(const std::string &pattern)
+        : pattern(pattern), z(patternZ(pattern)) {}
+
+    std::string pattern;
+    std::vector<size_t> z;
+};
+
+/* The window [left, right) of the text known to match a prefix of the
+ * pattern, in text positions: it plays the role of the Z-box of
+ * pattern + "#" + text, so that string is never built. */
+struct ZBox {
+    size_t left = 0;
+    size_t right = 0;
+};
+
+/* Bit k is set when text[k] == first and text[k + last_offset] == last,
+ * k < CANDIDATE_BLOCK: the positions where the pattern may start. */
+typedef uint32_t (*CandidateMask)(const char *text, size_t last_offset, char first, char last);
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static uint32_t candidateMaskAvx2(const char *text, size_t last_offset, char first, char last) {
+    __m256i heads = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text));
+    __m256i tails = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + last_offset));
+    __m256i both = _mm256_and_si256(
+        _mm256_cmpeq_epi8(heads, _mm256_set1_epi8(first)),
+        _mm256_cmpeq_epi8(tails, _mm256_set1_epi8(last))
+    );
+    return _mm256_movemask_epi8(both);
+}
+
+/* SSE2 is part of x86-64, two halves of 16 positions */
+static uint32_t candidateMaskSse2(const char *text, size_t last_offset, char first, char last) {
+    __m128i first_bytes = _mm_set1_epi8(first);
+    __m128i last_bytes = _mm_set1_epi8(last);
+    uint32_t mask = 0;
+    for (size_t half = 0; half < 2; ++half) {
+        const char *at = text + half * 16;
+        __m128i heads = _mm_loadu_si128(reinterpret_cast<const __m128i *>(at));
+        __m128i tails = _mm_loadu_si128(reinterpret_cast<const __m128i *>(at + last_offset));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(heads, first_bytes), _mm_cmpeq_epi8(tails, last_bytes));
+        mask |= uint32_t(_mm_movemask_epi8(both)) << (half * 16);
+    }
+    return mask;
+}
+#else
+static uint32_t candidateMaskScalar(const char *text, size_t last_offset, char first, char last) {
+    uint32_t mask = 0;
+    for (size_t k = 0; k < CANDIDATE_BLOCK; ++k) {
+        mask |= uint32_t(text[k] == first && text[k + last_offset] == last) << k;
+    }
+    return mask;
+}
+#endif
+
+/* the widest version the CPU supports */
+static CandidateMask candidateMask() {
+    static const CandidateMask mask = []() -> CandidateMask {
+#ifdef __x86_64__
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return candidateMaskAvx2;
+        }
+        return candidateMaskSse2;
+#else
+        return candidateMaskScalar;
+#endif
+    }();
+    return mask;
+}
+
+/* Z matching of the positions [from, to) of text, which starts at text
+ * position base; |pattern| bytes from every position must be available.
+ * report(position) is called for every match in increasing order. */
+template <typename Report>
+void zScan(
+    const PatternIndex &index,
+    const char *text,
+    size_t base,
+    size_t from,
+    size_t to,
+    ZBox &box,
+    Report report
+) {
+    const std::string &pattern = index.pattern;
+    size_t p = pattern.length();
+
+    for (size_t i = from; i < to; ++i) {
+        size_t z_val = 0;
+        if (i < box.right) {
+            z_val = std::min(box.right - i, index.z[i - box.left]);
         }
-        if (i < pattern.length()) {
-            z[i] = z_val;           //save only prefix
+        while (
+            z_val < p &&
+            pattern[z_val] == text[i + z_val - base]
+        ) {
+            ++z_val;
         }
-        if (i > pattern.length() && z_val == pattern.length()) {
-            positions.push_back(i - pattern.length() - 1);
+        if (i + z_val > box.right) {
+            box.left = i;
+            box.right = i + z_val;
+        }
+        if (z_val == p) {
+            report(i);
         }
     }
+}
+
+/* Matching of text[0, size), which starts at text position base.
+ * A position is scanned only while |pattern| bytes from it are available;
+ * report(position) is called for every match in increasing order.
+ * Whole blocks of positions are first tested on the pattern's first and
+ * last bytes with SIMD compares, only the candidates go through the Z step.
+ * Skipped positions leave the box valid, and a candidate compares bytes
+ * only beyond box.right except for one mismatch, so the work stays linear
+ * in the text even for periodic input.
+ * Returns how many leading bytes were scanned. */
+template <typename Report>
+size_t scanText(
+    const PatternIndex &index,
+    const char *text,
+    size_t base,
+    size_t size,
+    ZBox &box,
+    Report report
+) {
+    const std::string &pattern = index.pattern;
+    size_t p = pattern.length();
+    if (size < p) {
+        return 0;
+    }
+    size_t end = base + size - p + 1;
+    CandidateMask mask_of = candidateMask();
+
+    size_t i = base;
+    for (; i + CANDIDATE_BLOCK <= end; i += CANDIDATE_BLOCK) {
+        uint32_t mask = mask_of(text + (i - base), p - 1, pattern[0], pattern[p - 1]);
+        if (mask == 0) {
+            continue;
+        }
+        for (; mask != 0; mask &= mask - 1) {
+            size_t pos = i + __builtin_ctz(mask);
+            zScan(index, text, base, pos, pos + 1, box, report);
+        }
+    }
+    zScan(index, text, base, i, end, box, report);
+
+    return end - base;
+}
+
+/* Z matching of a text that arrives piece by piece: only the pattern index
+ * and the unscanned tail are kept, a position is scanned once |pattern|
+ * bytes from it are available, memory is O(|pattern| + piece size). */
+class StreamMatcher {
+public:
+
+    explicit StreamMatcher(const PatternIndex &index) : index_(index) {}
+
+    /* report(position) is called for every match that fits in the text
+     * received so far, in increasing order */
+    template <typename Report>
+    void push(const char *data, size_t size, Report report) {
+        window_.insert(window_.end(), data, data + size);
+        size_t scanned = scanText(index_, window_.data(), base_, window_.size(), box_, report);
+
+        /* scanned bytes are never compared again */
+        window_.erase(window_.begin(), window_.begin() + scanned);
+        base_ += scanned;
+    }
+
+private:
+
+    const PatternIndex &index_;
+    /* unscanned text, window_[0] is text position base_ */
+    std::vector<char> window_;
+    size_t base_ = 0;
+    ZBox box_;
+
+};
+
+std::vector<size_t> findPositions(
+    const std::string &pattern,
+    const std::string &text
+) {
+
+    std::vector<size_t> positions;
+    if (pattern.empty()) {
+        return positions;
+    }
+    PatternIndex index(pattern);
+    ZBox box;
+    scanText(index, text.data(), 0, text.length(), box, [&](size_t pos) {
+        positions.push_back(pos);
+    });
 
     return positions;
 
 }
 
+/* The text is the next whitespace-delimited word of `in`, it is matched
+ * chunk by chunk and the positions are written as they are found. */
+void streamPositions(
+    std::istream &in,
+    const std::string &pattern,
+    std::ostream &out
+) {
+    PatternIndex index(pattern);
+    StreamMatcher matcher(index);
+    auto report = [&](size_t pos) {
+        out << pos << " ";
+    };
+    std::vector<char> chunk(TEXT_CHUNK_SIZE);
+
+    in >> std::ws;
+    std::streambuf *buffer = in.rdbuf();
+    for (;;) {
+        std::streamsize got = buffer->sgetn(chunk.data(), chunk.size());
+        if (got <= 0) {
+            break;
+        }
+        auto word_end = std::find_if(chunk.begin(), chunk.begin() + got, [](char c) {
+            return std::isspace(static_cast<unsigned char>(c));
+        });
+        matcher.push(chunk.data(), word_end - chunk.begin(), report);
+        if (word_end != chunk.begin() + got) {
+            break;
+        }
+    }
+}
+
+/* the whole file is the text, read with read(2); false if it cannot be read */
+bool streamPositions(
+    int fd,
+    const std::string &pattern,
+    std::ostream &out
+) {
+    PatternIndex index(pattern);
+    StreamMatcher matcher(index);
+    auto report = [&](size_t pos) {
+        out << pos << " ";
+    };
+    std::vector<char> chunk(TEXT_CHUNK_SIZE);
+
+    for (;;) {
+        ssize_t got = read(fd, chunk.data(), chunk.size());
+        if (got < 0) {
+            perror("Failed read text");
+            return false;
+        }
+        if (got == 0) {
+            return true;
+        }
+        matcher.push(chunk.data(), got, report);
+    }
+}
+
 void getInput(
     std::istream &in,
     std::string &find_template,
@@ -60,18 +339,114 @@ void setOutput(
     }
 }
 
-int main() {
+/* The file is mapped and searched in rounds of one chunk per thread. Every
+ * chunk is scanned together with the first |pattern| - 1 bytes of the next
+ * one, so a match across the border is found exactly once: by the chunk it
+ * starts in. All threads share the pattern index. The per-chunk results
+ * are already sorted and are written chunk by chunk, then the pages of the
+ * round are dropped. False if the file cannot be mapped (e.g. a pipe). */
+bool parallelPositions(
+    int fd,
+    const std::string &pattern,
+    size_t threads,
+    std::ostream &out
+) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    size_t size = info.st_size;
+    if (size == 0) {
+        return true;
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const char *text = static_cast<const char *>(mapping);
+
+    PatternIndex index(pattern);
+    size_t overlap = pattern.length() - 1;
+    size_t round_size = threads * THREAD_CHUNK_SIZE;
+    std::vector<std::vector<size_t>> positions(threads);
+    std::vector<std::thread> workers;
+
+    for (size_t round = 0; round < size; round += round_size) {
+        for (size_t t = 0; t < threads; ++t) {
+            size_t begin = std::min(size, round + t * THREAD_CHUNK_SIZE);
+            size_t end = std::min(size, begin + THREAD_CHUNK_SIZE + overlap);
+            positions[t].clear();
+            workers.emplace_back([&, t, begin, end]() {
+                ZBox box = {begin, begin};
+                scanText(index, text + begin, begin, end - begin, box, [&](size_t pos) {
+                    positions[t].push_back(pos);
+                });
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+
+        for (auto &chunk : positions) {
+            setOutput(out, chunk);
+        }
+        /* the overlap of the next round stays mapped */
+        size_t done = std::min(size, round + round_size);
+        size_t page = sysconf(_SC_PAGESIZE);
+        madvise(mapping, done / page * page, MADV_DONTNEED);
+    }
+
+    munmap(mapping, size);
+    return true;
+}
+
+/* task_A < input: pattern and text are the two words of stdin;
+ * task_A [--threads N] pattern file: the text is the whole file, searched
+ * by N threads (all cores by default) */
+int main(int argc, char **argv) {
 
     /* cin&cout optimization */
     std::ios_base::sync_with_stdio(false);
     std::cin.tie(nullptr);
 
-    std::string pattern, text;
-    getInput(std::cin, pattern, text);
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc == 5 && std::string(argv[1]) == "--threads") {
+        char *end = nullptr;
+        long value = std::strtol(argv[2], &end, 10);
+        if (*argv[2] == '\0' || *end != '\0' || value <= 0) {
+            std::cout << "WRONG ARGUMENTS, try: " << USAGE << std::endl;
+            return 0;
+        }
+        threads = value;
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 1 && argc != 3) {
+        std::cout << "WRONG ARGUMENTS, try: " << USAGE << std::endl;
+        return 0;
+    }
 
-    std::vector <size_t> result = findPositions(pattern, text);
+    if (argc == 3) {
+        std::string pattern(argv[1]);
+        int fd = open(argv[2], O_RDONLY);
+        if (fd < 0) {
+            perror("Failed open file");
+            return 0;
+        }
+        if (!pattern.empty() && (threads == 1 || !parallelPositions(fd, pattern, threads, std::cout))) {
+            streamPositions(fd, pattern, std::cout);
+        }
+        close(fd);
+        return 0;
+    }
 
-    setOutput(std::cout, result);
+    std::string pattern;
+    std::cin >> pattern;
+    if (!pattern.empty()) {
+        streamPositions(std::cin, pattern, std::cout);
+    }
 
     return 0;
 
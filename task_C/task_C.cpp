@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <bitset>
+#include <cmath>
+#include <complex>
 #include <iostream>
 #include <limits>
 #include <cstdint>
@@ -13,6 +16,7 @@
 const int32_t ST_MAX = std::numeric_limits<int32_t>::max(); // max int32_t
 const int32_t RESERVE_TEXT_SIZE = 2000005; // reserve text size for optimization buffer
 const int32_t RESERVE_PATTERN_SIZE = 5000; // reserve pattern size for optimization buffer
+const double FFT_VOTES_PER_POINT = 4; // expected Aho-Korasik votes per n * log2(n) of FFT work where FFT wins
 
 std::mutex protect_queue_mutex;
 
@@ -428,6 +432,144 @@ void fillTrieWithPattern(
     }
 }
 
+/* roots[half + j] = exp(pi * i * j / half) for every stage of a size n FFT,
+ * each one computed exactly so no error accumulates */
+std::vector<std::complex<double>> fftRoots(size_t n) {
+    std::vector<std::complex<double>> roots(std::max<size_t>(n, 2));
+    for (size_t half = 1; half < n; half <<= 1) {
+        for (size_t j = 0; j < half; ++j) {
+            double angle = M_PI * j / half;
+            roots[half + j] = std::complex<double>(std::cos(angle), std::sin(angle));
+        }
+    }
+    return roots;
+}
+
+/* iterative radix-2 FFT, size is a power of two; the inverse is not scaled */
+void fft(std::vector<std::complex<double>>& a, const std::vector<std::complex<double>>& roots, bool invert) {
+    size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(a[i], a[j]);
+        }
+    }
+    for (size_t half = 1; half < n; half <<= 1) {
+        for (size_t start = 0; start < n; start += 2 * half) {
+            for (size_t j = 0; j < half; ++j) {
+                /* spelled out: operator* of std::complex checks for infinities */
+                double w_re = roots[half + j].real();
+                double w_im = invert ? -roots[half + j].imag() : roots[half + j].imag();
+                std::complex<double> u = a[start + j];
+                std::complex<double> b = a[start + j + half];
+                std::complex<double> v(b.real() * w_re - b.imag() * w_im, b.real() * w_im + b.imag() * w_re);
+                a[start + j] = u + v;
+                a[start + j + half] = u - v;
+            }
+        }
+    }
+}
+
+/* The pattern matches at i iff
+ *   sum_j w_j (p_j - t_(i+j))^2 = sum w p^2 - 2 sum w p t + sum w t^2 = 0,
+ * where w_j is 0 for '?' and 1 otherwise and letters are 1..26. Both
+ * correlations come from three FFTs: w + i*wp of the reversed pattern and
+ * t + i*t^2 of the text are transformed together and split by symmetry.
+ * A cyclic convolution of the text length is enough, the positions that
+ * are needed do not wrap. The cost does not depend on the fragments. */
+template <typename T>
+void searchFft(
+    ResultProcessWrapper<T> &out,
+    const std::string &pattern,
+    const std::string &s,
+    int32_t pattern_len
+) {
+    int32_t s_len = s.length();
+    if (pattern_len > s_len) {
+        return;
+    }
+    size_t n = 1;
+    while (n < static_cast<size_t>(s_len)) {
+        n <<= 1;
+    }
+
+    std::vector<std::complex<double>> p(n);
+    std::vector<std::complex<double>> t(n);
+    double constant = 0;
+    for (int32_t j = 0; j < pattern_len; ++j) {
+        if (pattern[j] != '?') {
+            double value = pattern[j] - 'a' + 1;
+            p[pattern_len - 1 - j] = std::complex<double>(1, value);
+            constant += value * value;
+        }
+    }
+    for (int32_t i = 0; i < s_len; ++i) {
+        double value = s[i] - 'a' + 1;
+        t[i] = std::complex<double>(value, value * value);
+    }
+    std::vector<std::complex<double>> roots = fftRoots(n);
+    fft(p, roots, false);
+    fft(t, roots, false);
+
+    /* for z = x + i*y: X[k] = (Z[k] + conj(Z[-k])) / 2, Y[k] = (Z[k] - conj(Z[-k])) / 2i */
+    std::vector<std::complex<double>> r(n);
+    const std::complex<double> half_i(0, 0.5);
+    for (size_t k = 0; k < n; ++k) {
+        std::complex<double> p_conj = std::conj(p[(n - k) & (n - 1)]);
+        std::complex<double> t_conj = std::conj(t[(n - k) & (n - 1)]);
+        std::complex<double> w = (p[k] + p_conj) * 0.5;
+        std::complex<double> wp = (p[k] - p_conj) * -half_i;
+        std::complex<double> t1 = (t[k] + t_conj) * 0.5;
+        std::complex<double> t2 = (t[k] - t_conj) * -half_i;
+        r[k] = w * t2 - 2.0 * wp * t1;
+    }
+    fft(r, roots, true);
+
+    for (int32_t i = 0; i + pattern_len <= s_len; ++i) {
+        double score = constant + r[i + pattern_len - 1].real() / n;
+        if (std::abs(score) < 0.5) {
+            out.process(i);
+        }
+    }
+}
+
+/* Aho-Korasik casts a vote for every pattern position of every fragment
+ * found in the text, so with repeated fragments that match often it
+ * approaches O(n * m). The expected number of votes is estimated from the
+ * letter frequencies of the text and compared with the cost of the FFTs. */
+bool preferFft(const std::string &pattern, const std::string &s) {
+    std::vector<double> frequency(256, 0);
+    for (unsigned char ch : s) {
+        frequency[ch] += 1.0 / s.length();
+    }
+    double votes = 0;
+    double probability = 1;
+    bool in_fragment = false;
+    for (unsigned char ch : pattern) {
+        if (ch == '?') {
+            votes += in_fragment ? probability : 0;
+            probability = 1;
+            in_fragment = false;
+        } else {
+            probability *= frequency[ch];
+            in_fragment = true;
+        }
+    }
+    votes += in_fragment ? probability : 0;
+
+    size_t n = 1;
+    size_t log_n = 0;
+    while (n < s.length()) {
+        n <<= 1;
+        ++log_n;
+    }
+    return votes * s.length() > FFT_VOTES_PER_POINT * n * log_n;
+}
+
 template <typename T>
 void search(
     ResultProcessWrapper<T> out,
@@ -435,6 +577,11 @@ void search(
     const std::string &s
 ) {
 
+    if (preferFft(pattern, s)) {
+        searchFft(out, pattern, s, pattern.length());
+        return;
+    }
+
     Trie<T> Trie;
     std::vector<std::vector<int32_t>> patterns_positions;
     std::vector<int32_t> patterns_pos_vector_indexes;
@@ -442,6 +589,8 @@ void search(
 
     fillTrieWithPattern(Trie, pattern, patterns_positions, patterns_pos_vector_indexes, has_fictive_symbol);
 
+    int32_t pattern_len = pattern.length() - static_cast<int32_t>(has_fictive_symbol);
+
     std::vector<int32_t> result(s.length(), 0);
     Trie.findPositions(
         out,
@@ -449,7 +598,7 @@ void search(
         patterns_positions,
         patterns_pos_vector_indexes,
         result,
-        pattern.length() - static_cast<int32_t>(has_fictive_symbol)
+        pattern_len
     );
 
 }